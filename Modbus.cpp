@@ -5,6 +5,312 @@
 
 #include "Modbus.h"
 
+/**
+ * @brief Run one request and build its reply in 'response'
+ * 
+ * @param pdu Request PDU, starting at the function code (whatever transport it came in on)
+ * @param len Length of the PDU
+ * @return const Result
+ */
+const Result ModmataPeripheral::execute(const uint8_t * pdu, const size_t len) {
+    const unsigned long start = micros();
+    const Result r = dispatch(pdu, len);
+    telemetry.countRequest(pdu[0], micros() - start, r.isException());
+    return r;
+}
+
+const Result ModmataPeripheral::dispatch(const uint8_t * pdu, const size_t len) {
+    const uint8_t code = pdu[0];
+    FunctionEntry f;
+    if (!lookup(code, f)) return makeException(code, MB_EX_ILLEGAL_FUNCTION);
+    if (len < f.minLength) return makeException(code, MB_EX_ILLEGAL_VALUE);
+
+    // Fields are big-endian on the wire; addresses are passed on as they are (0-based in each
+    // space), which is also how each space's table is keyed, so they're never translated
+    RequestFields r;
+    r.code = code;
+    r.data = pdu + 1;
+    r.len = len - 1;
+
+    switch (f.layout) {
+        case LAYOUT_ADDR_COUNT:
+        case LAYOUT_ADDR_BITS:
+        case LAYOUT_ADDR_VALUE:
+            r.address = makeWord(pdu[1], pdu[2]);
+            r.value = makeWord(pdu[3], pdu[4]);
+            break;
+
+        case LAYOUT_ADDR_COUNT_BYTES:
+            r.address = makeWord(pdu[1], pdu[2]);
+            r.value = makeWord(pdu[3], pdu[4]);
+            r.data = pdu + 5;
+            r.len = len - 5;
+            if (r.len < 1u + pdu[5]) return makeException(code, MB_EX_ILLEGAL_VALUE);  // bytes cut short
+            break;
+
+        case LAYOUT_PIN:
+            r.address = pdu[1];
+            break;
+
+        case LAYOUT_PIN_BYTE:
+            r.address = pdu[1];
+            r.value = pdu[2];
+            break;
+
+        case LAYOUT_PIN_WORD:
+            r.address = pdu[1];
+            r.value = makeWord(pdu[2], pdu[3]);
+            break;
+
+        case LAYOUT_ADDR:
+            r.address = makeWord(pdu[1], pdu[2]);
+            break;
+    }
+
+    return f.handler(*this, r);
+}
+
+// Most bytes a reply to 'pdu' can take, judged from its request without running it: reads from the
+// count they ask for, the built-ins that say from their request, and never more than the bound the
+// function was registered with
+const size_t ModmataPeripheral::replyBound(const uint8_t * pdu, const size_t len) const {
+    FunctionEntry f;
+    if (!lookup(pdu[0], f) || len < f.minLength) return 2;     // an exception
+
+    // Only these layouts have a count at [3..4]; other requests may be 2 or 3 bytes long
+    size_t bound;
+    switch (f.layout) {
+        case LAYOUT_ADDR_BITS:  bound = 2 + (makeWord(pdu[3], pdu[4]) + 7) / 8;    break;
+        case LAYOUT_ADDR_COUNT: bound = 2 + 2 * makeWord(pdu[3], pdu[4]);          break;
+        default:                bound = f.bound != nullptr ? f.bound(pdu, len) : MB_PDU_MAX;  break;
+    }
+    return bound < f.maxReply ? bound : f.maxReply;
+}
+
+const bool ModmataPeripheral::cacheable(const uint8_t * pdu, const size_t len) const {
+    if (len != 5) return false;
+
+    const uint16_t address = makeWord(pdu[1], pdu[2]);
+    const uint16_t count = makeWord(pdu[3], pdu[4]);
+    const uint32_t end = uint32_t(address) + count;
+
+    switch (pdu[0]) {
+        case MB_FC_READ_COILS:      return !coils.bound(address, count);
+        case MB_FC_READ_DISCRETES:  return !discretes.bound(address, count);
+        case MB_FC_READ_HOLDINGS:   return !holdings.bound(address, count);
+
+        case MB_FC_READ_INPUTS:
+            // The telemetry and sampler blocks are generated at request time, attached or not
+            if (address < MB_TELEMETRY_BASE + MB_TELEMETRY_REGISTERS && end > MB_TELEMETRY_BASE) return false;
+            if (address < MB_SAMPLER_BASE + MB_SAMPLER_REGISTERS && end > MB_SAMPLER_BASE) return false;
+            return !inputs.bound(address, count);
+
+        default:                    return false;
+    }
+}
+
+// The override slot for 'code': the one it has already, or else a free one (nullptr if all are taken)
+FunctionEntry * ModmataPeripheral::overrideFor(const uint8_t code) {
+    FunctionEntry * free = nullptr;
+    for (uint8_t i = 0; i < MB_FC_OVERRIDES; i++) {
+        if (overrides[i].code == code) return &overrides[i];
+        if (overrides[i].code == 0 && free == nullptr) free = &overrides[i];
+    }
+    return free;
+}
+
+const bool ModmataPeripheral::registerFunction(const uint8_t code, const FIELD_LAYOUT layout,
+                                               FunctionHandler handler, const uint8_t minLength,
+                                               const uint8_t maxReply) {
+    if (code == 0 || code >= MB_FC_TABLE_SIZE || handler == nullptr) return false;
+
+    FunctionEntry * f = overrideFor(code);
+    if (f == nullptr) return false;
+
+    f->code = code;
+    f->handler = handler;
+    f->layout = layout;
+    f->minLength = minLength;
+    f->maxReply = maxReply;
+    f->bound = nullptr;
+    return true;
+}
+
+const void ModmataPeripheral::unregisterFunction(const uint8_t code) {
+    if (code == 0 || code >= MB_FC_TABLE_SIZE) return;
+
+    FunctionEntry * f = overrideFor(code);
+    if (f == nullptr) return;
+    *f = FunctionEntry();
+
+    // A built-in one stays shadowed by an override that has no handler
+    FunctionEntry builtin;
+    if (lookup(code, builtin)) f->code = code;
+}
+
+// Built-in functions: adapt the decoded fields to the handler signatures
+
+static const Result _fc_read_coils(ModmataPeripheral& p, const RequestFields& r)      { return p.ReadCoils(r.address, r.value); }
+static const Result _fc_read_discretes(ModmataPeripheral& p, const RequestFields& r)  { return p.ReadDiscretes(r.address, r.value); }
+static const Result _fc_read_holdings(ModmataPeripheral& p, const RequestFields& r)   { return p.ReadHoldings(r.address, r.value); }
+static const Result _fc_read_inputs(ModmataPeripheral& p, const RequestFields& r)     { return p.ReadInputs(r.address, r.value); }
+static const Result _fc_read_fifo(ModmataPeripheral& p, const RequestFields& r)       { return p.ReadFifo(r.address); }
+static const Result _fc_read_changes(ModmataPeripheral& p, const RequestFields& r) {
+    // [space][since: 4 bytes][start address]
+    const uint32_t since = uint32_t(makeWord(r.data[1], r.data[2])) << 16 | makeWord(r.data[3], r.data[4]);
+    return p.ReadChanges(r.data[0], since, makeWord(r.data[5], r.data[6]));
+}
+static const Result _fc_read_compressed(ModmataPeripheral& p, const RequestFields& r) {
+    // [space][address][amount]
+    return p.ReadCompressed(r.data[0], makeWord(r.data[1], r.data[2]), makeWord(r.data[3], r.data[4]));
+}
+static const Result _fc_write_coil(ModmataPeripheral& p, const RequestFields& r)      { return p.WriteCoil(r.address, r.value); }
+static const Result _fc_write_holding(ModmataPeripheral& p, const RequestFields& r)   { return p.WriteHolding(r.address, r.value); }
+static const Result _fc_write_coils(ModmataPeripheral& p, const RequestFields& r)     { return p.WriteCoils(r.address, r.value, r.data); }
+static const Result _fc_write_holdings(ModmataPeripheral& p, const RequestFields& r)  { return p.WriteHoldings(r.address, r.value, r.data); }
+static const Result _fc_mask_write_holding(ModmataPeripheral& p, const RequestFields& r) {
+    return p.MaskWriteHolding(r.address, r.value, makeWord(r.data[4], r.data[5]));
+}
+static const Result _fc_read_write_holdings(ModmataPeripheral& p, const RequestFields& r) {
+    // [read address][read count][write address][write count][byte count][bytes ...]
+    if (r.len < 9u + r.data[8]) return p.makeException(r.code, MB_EX_ILLEGAL_VALUE);
+    return p.ReadWriteHoldings(r.address, r.value, makeWord(r.data[4], r.data[5]), makeWord(r.data[6], r.data[7]), r.data + 8);
+}
+static const Result _fc_port_read(ModmataPeripheral& p, const RequestFields& r)      { return p.PortRead(r.address); }
+static const Result _fc_port_write(ModmataPeripheral& p, const RequestFields& r) {
+    // [port][mask hi][mask lo][value hi][value lo]
+    return p.PortWrite(r.address, r.value, makeWord(r.data[3], r.data[4]));
+}
+static const Result _fc_batch(ModmataPeripheral& p, const RequestFields& r)         { return p.Batch(r.data, r.len); }
+static const Result _fc_pin_mode(ModmataPeripheral& p, const RequestFields& r)        { return p.PinMode(r.address, r.value); }
+static const Result _fc_digital_read(ModmataPeripheral& p, const RequestFields& r)    { return p.DigitalRead(r.address); }
+static const Result _fc_digital_write(ModmataPeripheral& p, const RequestFields& r)   { return p.DigitalWrite(r.address, r.value); }
+static const Result _fc_analog_read(ModmataPeripheral& p, const RequestFields& r)     { return p.AnalogRead(r.address); }
+static const Result _fc_analog_write(ModmataPeripheral& p, const RequestFields& r)    { return p.AnalogWrite(r.address, r.value); }
+static const Result _fc_wire_begin_peripheral(ModmataPeripheral& p, const RequestFields& r) { return p.WireBeginPeripheral(r.address); }
+static const Result _fc_wire_begin_controller(ModmataPeripheral& p, const RequestFields&) { return p.WireBeginController(); }
+static const Result _fc_wire_end(ModmataPeripheral& p, const RequestFields&)         { return p.WireEnd(); }
+static const Result _fc_wire_clock(ModmataPeripheral& p, const RequestFields& r) {
+    return p.WireClock(uint32_t(makeWord(r.data[0], r.data[1])) << 16 | makeWord(r.data[2], r.data[3]));
+}
+static const Result _fc_wire_read(ModmataPeripheral& p, const RequestFields& r)      { return p.WireRead(r.address, r.value); }
+static const Result _fc_wire_write(ModmataPeripheral& p, const RequestFields& r) {
+    // [address][count][bytes ...]
+    if (r.len < 2u + r.data[1]) return p.makeException(r.code, MB_EX_ILLEGAL_VALUE);
+    return p.WireWrite(r.data[0], r.data[1], r.data + 2);
+}
+static const Result _fc_wire_transactions(ModmataPeripheral& p, const RequestFields& r) { return p.WireTransactions(r.data, r.len); }
+static const Result _fc_spi_begin(ModmataPeripheral& p, const RequestFields&)        { return p.SpiBegin(); }
+static const Result _fc_spi_end(ModmataPeripheral& p, const RequestFields&)          { return p.SpiEnd(); }
+static const Result _fc_spi_settings(ModmataPeripheral& p, const RequestFields& r) {
+    // [chip select][clock: 4 bytes][bit order][mode]
+    const uint32_t clock = uint32_t(makeWord(r.data[1], r.data[2])) << 16 | makeWord(r.data[3], r.data[4]);
+    return p.SpiSettings(r.data[0], clock, r.data[5], r.data[6]);
+}
+static const Result _fc_spi_transfer(ModmataPeripheral& p, const RequestFields& r)   { return p.SpiTransfer(r.data, r.len); }
+
+// Reply bounds of the built-ins whose reply size the request decides
+
+static const size_t _bound_read_changes(const uint8_t *, const size_t) {
+    // Pages its reply to the room left in the frame (see ReadChanges()), so it needs room for one change
+    return 8 + 4;
+}
+static const size_t _bound_read_compressed(const uint8_t * pdu, const size_t) {
+    // [func][register count][coded block], coded over the raw read moved up 2 bytes: that's the most it takes
+    return 4 + 2u * makeWord(pdu[4], pdu[5]);
+}
+static const size_t _bound_wire_transactions(const uint8_t * pdu, const size_t len) {
+    // [func][count] ([address][write count][bytes ...][read count]) ... -> [func][count] ([status][read count][bytes ...]) ...
+    size_t bound = 2;
+    size_t pos = 2;
+    for (uint8_t i = 0; i < pdu[1]; i++) {
+        if (pos + 2 >= len || pos + 2 + pdu[pos + 1] >= len) return 2;     // malformed: an exception
+        bound += 2 + pdu[pos + 2 + pdu[pos + 1]];
+        pos += 3 + pdu[pos + 1];
+    }
+    return bound;
+}
+static const size_t _bound_spi_transfer(const uint8_t *, const size_t len) {
+    // [func][bytes ...] -> [func][bytes read back ...]
+    return len;
+}
+
+// The built-in functions, in order of function code. Reads size their replies from the count they
+// ask for, a few others from their request (the bound column); the rest give their longest reply
+// (0: up to a whole PDU). Replies are never shorter than an exception's 2 bytes. A min length of 0
+// is the layout's own.
+static const FunctionEntry builtinFunctions[] PROGMEM = {
+    // code                         handler                     layout                      min max reply               bound
+    {MB_FC_READ_COILS,              _fc_read_coils,             LAYOUT_ADDR_BITS,           0,  0,                      nullptr},
+    {MB_FC_READ_DISCRETES,          _fc_read_discretes,         LAYOUT_ADDR_BITS,           0,  0,                      nullptr},
+    {MB_FC_READ_HOLDINGS,           _fc_read_holdings,          LAYOUT_ADDR_COUNT,          0,  0,                      nullptr},
+    {MB_FC_READ_INPUTS,             _fc_read_inputs,            LAYOUT_ADDR_COUNT,          0,  0,                      nullptr},
+    {MB_FC_WRITE_COIL,              _fc_write_coil,             LAYOUT_ADDR_VALUE,          0,  5,                      nullptr},
+    {MB_FC_WRITE_HOLDING,           _fc_write_holding,          LAYOUT_ADDR_VALUE,          0,  5,                      nullptr},
+    {MB_FC_WRITE_COILS,             _fc_write_coils,            LAYOUT_ADDR_COUNT_BYTES,    0,  5,                      nullptr},
+    {MB_FC_WRITE_HOLDINGS,          _fc_write_holdings,         LAYOUT_ADDR_COUNT_BYTES,    0,  5,                      nullptr},
+    {MB_FC_MASK_WRITE_HOLDING,      _fc_mask_write_holding,     LAYOUT_ADDR_VALUE,          7,  7,                      nullptr},
+    {MB_FC_READ_WRITE_HOLDINGS,     _fc_read_write_holdings,    LAYOUT_ADDR_COUNT,          10, 0,                      nullptr},
+    {MB_FC_READ_FIFO,               _fc_read_fifo,              LAYOUT_ADDR,                0,  5 + 2 * MB_FIFO_MAX,    nullptr},
+    {MB_FC_PINMODE,                 _fc_pin_mode,               LAYOUT_PIN_BYTE,            0,  5,                      nullptr},
+    {MB_FC_DIGITAL_READ,            _fc_digital_read,           LAYOUT_PIN,                 0,  5,                      nullptr},
+    {MB_FC_DIGITAL_WRITE,           _fc_digital_write,          LAYOUT_PIN_BYTE,            0,  5,                      nullptr},
+    {MB_FC_ANALOG_READ,             _fc_analog_read,            LAYOUT_PIN,                 0,  5,                      nullptr},
+    {MB_FC_ANALOG_WRITE,            _fc_analog_write,           LAYOUT_PIN_WORD,            0,  5,                      nullptr},
+    {MB_FC_WIRE_BEGIN_PERIPHERAL,   _fc_wire_begin_peripheral,  LAYOUT_PIN,                 0,  2,                      nullptr},
+    {MB_FC_WIRE_BEGIN_CONTROLLER,   _fc_wire_begin_controller,  LAYOUT_RAW,                 0,  2,                      nullptr},
+    {MB_FC_BATCH,                   _fc_batch,                  LAYOUT_RAW,                 2,  0,                      nullptr},
+#ifdef portOutputRegister
+    {MB_FC_PORT_READ,               _fc_port_read,              LAYOUT_PIN,                 0,  5,                      nullptr},
+    {MB_FC_PORT_WRITE,              _fc_port_write,             LAYOUT_PIN_WORD,            6,  6,                      nullptr},
+#endif
+    {MB_FC_WIRE_END,                _fc_wire_end,               LAYOUT_RAW,                 0,  2,                      nullptr},
+    {MB_FC_WIRE_CLK,                _fc_wire_clock,             LAYOUT_RAW,                 5,  5,                      nullptr},
+    {MB_FC_WIRE_READ,               _fc_wire_read,              LAYOUT_PIN_BYTE,            0,  2 + MB_WIRE_BUFFER,     nullptr},
+    {MB_FC_WIRE_WRITE,              _fc_wire_write,             LAYOUT_RAW,                 3,  3,                      nullptr},
+    {MB_FC_WIRE_TRANSACTIONS,       _fc_wire_transactions,      LAYOUT_RAW,                 2,  0,                      _bound_wire_transactions},
+    {MB_FC_SPI_BEGIN,               _fc_spi_begin,              LAYOUT_RAW,                 0,  2,                      nullptr},
+    {MB_FC_SPI_END,                 _fc_spi_end,                LAYOUT_RAW,                 0,  2,                      nullptr},
+    {MB_FC_SPI_SETTINGS,            _fc_spi_settings,           LAYOUT_RAW,                 8,  8,                      nullptr},
+    {MB_FC_SPI_TRANSFER,            _fc_spi_transfer,           LAYOUT_RAW,                 2,  0,                      _bound_spi_transfer},
+    {MB_FC_READ_CHANGES,            _fc_read_changes,           LAYOUT_RAW,                 8,  0,                      _bound_read_changes},
+    {MB_FC_READ_COMPRESSED,         _fc_read_compressed,        LAYOUT_RAW,                 6,  0,                      _bound_read_compressed},
+};
+
+#define BUILTIN_FUNCTIONS   (sizeof(builtinFunctions) / sizeof(builtinFunctions[0]))
+
+const bool ModmataPeripheral::lookup(const uint8_t code, FunctionEntry& f) const {
+    if (code == 0 || code >= MB_FC_TABLE_SIZE) return false;
+
+    bool found = false;
+    for (uint8_t i = 0; i < MB_FC_OVERRIDES && !found; i++) {
+        if (overrides[i].code != code) continue;
+        f = overrides[i];
+        found = true;
+    }
+
+    // Sorted, so the search stops at the first higher code
+    for (uint8_t i = 0; i < BUILTIN_FUNCTIONS && !found; i++) {
+        const uint8_t c = pgm_read_byte(&builtinFunctions[i].code);
+        if (c > code) break;
+        if (c != code) continue;
+        memcpy_P(&f, &builtinFunctions[i], sizeof(FunctionEntry));
+        found = true;
+    }
+
+    // An override without a handler is a built-in that was unregistered
+    if (!found || f.handler == nullptr) return false;
+
+    if (f.minLength < layoutMinLength[f.layout]) f.minLength = layoutMinLength[f.layout];
+    if (f.maxReply == 0 || f.maxReply > MB_PDU_MAX) f.maxReply = MB_PDU_MAX;
+    return true;
+}
+
+// Whether the 'amount' addresses from 'address' on all lie within one register space
+static const bool _inSpace(const uint16_t address, const uint16_t amount) {
+    return uint32_t(address) + amount <= MB_SPACE_SIZE;
+}
+
 /**
  * @brief Read multiple (sequential) Modbus coil registers
  * 
@@ -14,27 +320,19 @@
  */
 const Result ModmataPeripheral::ReadCoils(const uint16_t address, const uint16_t amount) const {
 
-    const bool ILLEGAL_VALUE = !(amount >= 1 && amount <= 7000);
-    const bool ILLEGAL_ADDRESS = !(address >= 0  && address <= 9998 && address + amount <= 9998);
+    const bool ILLEGAL_VALUE = !(amount >= 1 && amount <= MB_MAX_READ_BITS);
+    const bool ILLEGAL_ADDRESS = !_inSpace(address, amount);
 
-    if (ILLEGAL_VALUE)      return Result(MB_FC_READ_COILS, MB_EX_ILLEGAL_VALUE);
-    if (ILLEGAL_ADDRESS)    return Result(MB_FC_READ_COILS, MB_EX_ILLEGAL_ADDRESS);
+    if (ILLEGAL_VALUE)      return makeException(MB_FC_READ_COILS, MB_EX_ILLEGAL_VALUE);
+    if (ILLEGAL_ADDRESS)    return makeException(MB_FC_READ_COILS, MB_EX_ILLEGAL_ADDRESS);
 
-    const uint8_t f = amount / 8; // floor
-    const uint8_t r = amount % 8; // remainder
-    const uint8_t size = f + bool(r);
+    const uint8_t size = (amount + 7) / 8;
+    uint8_t * array = response.beginBytes(MB_FC_READ_COILS, size);
 
-    uint8_t array[size] = {0,};
-    uint16_t currentAddress = address + 1;
-    uint16_t numRegs = amount;
-
-    for (int i=0; i < size; i++) {
-        int regsThisLoop = (numRegs >= 8) ? 8 : numRegs;
-        array[i] = reverseBits(rangeToByte(currentAddress + i*8, regsThisLoop));
-        numRegs -= regsThisLoop;
-    }
+    // Coils are stored packed in wire order, so this is a shifted byte copy
+    coils.readBits(address, amount, array);
 
-    return Result(MB_FC_READ_COILS, size, array);
+    return response.result();
 }
 
 /**
@@ -57,27 +355,18 @@ const Result ModmataPeripheral::ReadCoil(const uint16_t address) const {
  */
 const Result ModmataPeripheral::ReadDiscretes(const uint16_t address, const uint16_t amount) const {
     // Essentially the same as Coils but with different codes and ranges
-    const bool ILLEGAL_VALUE = !(amount >= 1 && amount <= 7000);
-    const bool ILLEGAL_ADDRESS = !(address >= 10000  && address <= 19998 && address + amount <= 19998);
+    const bool ILLEGAL_VALUE = !(amount >= 1 && amount <= MB_MAX_READ_BITS);
+    const bool ILLEGAL_ADDRESS = !_inSpace(address, amount);
 
-    if (ILLEGAL_VALUE)      return Result(MB_FC_READ_DISCRETES, MB_EX_ILLEGAL_VALUE);
-    if (ILLEGAL_ADDRESS)    return Result(MB_FC_READ_DISCRETES, MB_EX_ILLEGAL_ADDRESS);
+    if (ILLEGAL_VALUE)      return makeException(MB_FC_READ_DISCRETES, MB_EX_ILLEGAL_VALUE);
+    if (ILLEGAL_ADDRESS)    return makeException(MB_FC_READ_DISCRETES, MB_EX_ILLEGAL_ADDRESS);
 
-    const uint8_t f = amount / 8; // floor
-    const uint8_t r = amount % 8; // remainder
-    const uint8_t size = f + bool(r);
+    const uint8_t size = (amount + 7) / 8;
+    uint8_t * array = response.beginBytes(MB_FC_READ_DISCRETES, size);
 
-    uint8_t array[size] = {0,};
-    uint16_t currentAddress = address + 1;
-    uint16_t numRegs = amount;
+    discretes.readBits(address, amount, array);
 
-    for (int i=0; i < size; i++) {
-        int regsThisLoop = (numRegs >= 8) ? 8 : numRegs;
-        array[i] = reverseBits(rangeToByte(currentAddress + i*8, regsThisLoop));
-        numRegs -= regsThisLoop;
-    }
-
-    return Result(MB_FC_READ_DISCRETES, size, array);
+    return response.result();
 }
 
 // SHOULD WORK
@@ -99,33 +388,19 @@ const Result ModmataPeripheral::ReadDiscrete(const uint16_t address) const {
  * @return const Result&
  */
 const Result ModmataPeripheral::ReadHoldings(const uint16_t address, const uint16_t amount) const {
-    const uint16_t actual_addr = address + 40001;
-
     const bool ILLEGAL_VALUE = !(amount >= 1 && amount <= 125);
-    const bool ILLEGAL_ADDRESS = !(actual_addr >= 40001 && actual_addr <= 49999 && actual_addr + amount <= 49999);
+    const bool ILLEGAL_ADDRESS = !_inSpace(address, amount);
 
-    if (ILLEGAL_VALUE) return Result(MB_FC_READ_HOLDINGS, MB_EX_ILLEGAL_VALUE);
-    if (ILLEGAL_ADDRESS) return Result(MB_FC_READ_HOLDINGS, MB_EX_ILLEGAL_ADDRESS);
+    if (ILLEGAL_VALUE) return makeException(MB_FC_READ_HOLDINGS, MB_EX_ILLEGAL_VALUE);
+    if (ILLEGAL_ADDRESS) return makeException(MB_FC_READ_HOLDINGS, MB_EX_ILLEGAL_ADDRESS);
 
     uint8_t size = amount * 2;
-    uint8_t array[size] = {0,};
-
-    for (int i=0; i < amount; i++) {
-        const Register ** r = table.getRegisterPtr(actual_addr + i);
+    uint8_t * array = response.beginBytes(MB_FC_READ_HOLDINGS, size);
 
-        if (validRegister(r)) {
-            uint16_t wrd = (**r).value;
-            array[   i*2   ] = highByte(wrd);
-            array[ (i*2)+1 ] = lowByte(wrd);
-        }
-
-        else {
-            array[   i*2   ] = 0u;
-            array[ (i*2)+1 ] = 0u;
-        }                   
-    }
+    // Unset registers read back as 0
+    holdings.readRange(address, amount, array);
 
-    return Result(MB_FC_READ_HOLDINGS, size, array);
+    return response.result();
 }
 
 /**
@@ -140,33 +415,41 @@ const Result ModmataPeripheral::ReadHolding(const uint16_t address) const {
 
 // SHOULD WORK
 const Result ModmataPeripheral::ReadInputs(const uint16_t address, const uint16_t amount) const {
-    const uint16_t actual_addr = address + 40001;
-
     const bool ILLEGAL_VALUE = !(amount >= 1 && amount <= 125);
-    const bool ILLEGAL_ADDRESS = !(actual_addr >= 30001 && actual_addr <= 39999 && actual_addr + amount <= 39999);
+    const bool ILLEGAL_ADDRESS = !_inSpace(address, amount);
 
-    if (ILLEGAL_VALUE) return Result(MB_FC_READ_INPUTS, MB_EX_ILLEGAL_VALUE);
-    if (ILLEGAL_ADDRESS) return Result(MB_FC_READ_INPUTS, MB_EX_ILLEGAL_ADDRESS);
+    if (ILLEGAL_VALUE) return makeException(MB_FC_READ_INPUTS, MB_EX_ILLEGAL_VALUE);
+    if (ILLEGAL_ADDRESS) return makeException(MB_FC_READ_INPUTS, MB_EX_ILLEGAL_ADDRESS);
 
     uint8_t size = amount * 2;
-    uint8_t array[size] = {0,};
-
-    for (int i=0; i < amount; i++) {
-        const Register ** r = table.getRegisterPtr(actual_addr + i);
+    uint8_t * array = response.beginBytes(MB_FC_READ_INPUTS, size);
+
+    // Unset registers read back as 0
+    inputs.readRange(address, amount, array);
+
+    // The telemetry block is generated on the fly over whatever the inputs table holds there
+    const uint16_t end = address + amount;
+    const uint16_t first = address > MB_TELEMETRY_BASE ? address : MB_TELEMETRY_BASE;
+    const uint16_t last = end < MB_TELEMETRY_BASE + MB_TELEMETRY_REGISTERS ? end : MB_TELEMETRY_BASE + MB_TELEMETRY_REGISTERS;
+    for (uint16_t a = first; a < last; a++) {
+        const uint16_t w = telemetryWord(a - MB_TELEMETRY_BASE);
+        array[2 * (a - address)] = highByte(w);
+        array[2 * (a - address) + 1] = lowByte(w);
+    }
 
-        if (validRegister(r)) {
-            uint16_t wrd = (**r).value;
-            array[   i*2   ] = highByte(wrd);
-            array[ (i*2)+1 ] = lowByte(wrd);
+    // So are the sampler's channel blocks
+    if (sampler != nullptr) {
+        const uint16_t top = MB_SAMPLER_BASE + sampler->size() * MB_SAMPLER_STRIDE;
+        const uint16_t from = address > MB_SAMPLER_BASE ? address : MB_SAMPLER_BASE;
+        const uint16_t to = end < top ? end : top;
+        for (uint16_t a = from; a < to; a++) {
+            const uint16_t w = sampler->word(a);
+            array[2 * (a - address)] = highByte(w);
+            array[2 * (a - address) + 1] = lowByte(w);
         }
-
-        else {
-            array[   i*2   ] = 0u;
-            array[ (i*2)+1 ] = 0u;
-        }                   
     }
 
-    return Result(MB_FC_READ_INPUTS, size, array);
+    return response.result();
 }
 
 // SHOULD WORK
@@ -174,116 +457,312 @@ const Result ModmataPeripheral::ReadInput(const uint16_t address) const {
     return this->ReadInputs(address, 1);
 }
 
-const Result ModmataPeripheral::WriteCoil(const uint16_t address, const uint16_t value) {
-    const uint16_t actual_addr = address+1;
+/**
+ * @brief Read only the registers that changed since the controller last looked
+ * 
+ * Reply: [change number: 4 bytes][resume address][count] ([address][value]) ...
+ * 
+ * The change number is the one to ask about next time. When more registers changed than fit,
+ * resume address is where to continue (with the same 'since'); it is 0xFFFF once the space is done.
+ * Addresses are protocol addresses, like the request's. Unknown or very old 'since' values
+ * (see RegisterArray::readChanged) return every register of the space. Each space counts its
+ * changes separately.
+ * 
+ * @param space MB_REGISTER_INPUT or MB_REGISTER_HOLDING
+ * @param since Change number from the previous reply (0 the first time)
+ * @param start Protocol address to start from
+ * @return const Result 
+ */
+const Result ModmataPeripheral::ReadChanges(const uint8_t space, const uint32_t since, const uint16_t start) {
+    const bool ILLEGAL_VALUE = !(space == MB_REGISTER_INPUT || space == MB_REGISTER_HOLDING);
+    const bool ILLEGAL_ADDRESS = !_inSpace(start, 1);
+
+    if (ILLEGAL_VALUE)      return makeException(MB_FC_READ_CHANGES, MB_EX_ILLEGAL_VALUE);
+    if (ILLEGAL_ADDRESS)    return makeException(MB_FC_READ_CHANGES, MB_EX_ILLEGAL_ADDRESS);
+
+    RegisterArray& table = registers(space);
+    const uint32_t seq = table.changes();
+
+    // One page is as many changes as fit in what's left of the frame (less than all of it in a batch)
+    const uint16_t page = (response.room() - 8) / 4;
+    uint8_t * data = response.begin(MB_FC_READ_CHANGES);
+    uint32_t resume;
+    const uint16_t n = table.readChanged(since, start, MB_SPACE_SIZE, data + 7, page, resume);
+    const uint16_t next = resume >= MB_SPACE_SIZE ? 0xFFFF : uint16_t(resume);
+
+    data[0] = uint8_t(seq >> 24);   data[1] = uint8_t(seq >> 16);
+    data[2] = uint8_t(seq >> 8);    data[3] = uint8_t(seq);
+    data[4] = highByte(next);       data[5] = lowByte(next);
+    data[6] = n;
+
+    response.setDataLen(7u + 4u * n);
+    return response.result();
+}
 
-    const bool ILLEGAL_VALUE = !(value == 0xFF00 || value == 0x0000);
-    const bool ILLEGAL_ADDRESS = !(actual_addr >= 1 && actual_addr <= 9999);
+/**
+ * @brief Read Inputs/Holdings, with the values run-length/delta coded for slow links
+ * 
+ * Reply: [register count][coded block] (format in compress.h). The read itself is an ordinary
+ * Read Inputs/Holdings, so validation, exceptions, bindings and the overlaid blocks are the same.
+ * The block is coded over the raw reply in place and is never more than one byte longer than it.
+ * 
+ * @param space MB_REGISTER_INPUT or MB_REGISTER_HOLDING
+ * @param address Protocol address of the first register
+ * @param amount Registers to read (1..125)
+ * @return const Result 
+ */
+const Result ModmataPeripheral::ReadCompressed(const uint8_t space, const uint16_t address, const uint16_t amount) const {
+    const bool ILLEGAL_VALUE = !(space == MB_REGISTER_INPUT || space == MB_REGISTER_HOLDING);
 
-    if (ILLEGAL_VALUE) return Result(MB_FC_WRITE_COIL, MB_EX_ILLEGAL_VALUE);
-    if (ILLEGAL_ADDRESS) return Result(MB_FC_WRITE_COIL, MB_EX_ILLEGAL_ADDRESS);
+    if (ILLEGAL_VALUE) return makeException(MB_FC_READ_COMPRESSED, MB_EX_ILLEGAL_VALUE);
 
-    if (table.verifySetRegister(actual_addr, value))
-        return Result(MB_FC_WRITE_COIL, actual_addr, value);
+    const Result raw = space == MB_REGISTER_INPUT ? ReadInputs(address, amount) : ReadHoldings(address, amount);
+    if (raw.isException()) return response.retag(MB_FC_READ_COMPRESSED);
 
-    return Result(MB_FC_WRITE_COIL, MB_EX_DEVICE_FAILURE);    
+    // [func][byte count][values] -> [func][register count][coded values]. The values move up two
+    // bytes first (into what is otherwise the CRC's room) so the coder can work in place behind them.
+    uint8_t * pdu = response.pdu();
+    memmove(pdu + 4, pdu + 2, 2u * amount);
+    const size_t coded = compressRegisters(pdu + 2, pdu + 4, amount);
+
+    uint8_t * data = response.begin(MB_FC_READ_COMPRESSED);
+    data[0] = uint8_t(amount);
+    response.setDataLen(1u + coded);
+    return response.result();
 }
 
-const Result ModmataPeripheral::WriteCoils(const uint16_t address, const uint16_t amount, const uint8_t * values) {
-    const uint16_t actual_addr = address+1;
+/**
+ * @brief Take the oldest samples off a sampler channel (Read FIFO Queue)
+ * 
+ * Up to 31 samples per request; whatever is left stays queued for the next one.
+ * 
+ * @param pointerAddress Input address of the channel's block (MB_SAMPLER_BASE + channel * MB_SAMPLER_STRIDE)
+ * @return const Result [byte count: 2][FIFO count: 2][samples ...]
+ */
+const Result ModmataPeripheral::ReadFifo(const uint16_t pointerAddress) {
+    const int channel = sampler != nullptr ? sampler->channelAt(pointerAddress) : -1;
 
-    const bool ILLEGAL_VALUE = !(amount >= 1 && amount <= 7000);
-    const bool ILLEGAL_ADDRESS = !(actual_addr >= 1  && actual_addr <= 9999 && actual_addr + amount <= 9999);
-    bool DEVICE_FAIL = false;
+    const bool ILLEGAL_ADDRESS = !(channel >= 0 && (pointerAddress - MB_SAMPLER_BASE) % MB_SAMPLER_STRIDE == 0);
+    if (ILLEGAL_ADDRESS) return makeException(MB_FC_READ_FIFO, MB_EX_ILLEGAL_ADDRESS);
 
-    if (ILLEGAL_VALUE)      return Result(MB_FC_WRITE_COILS, MB_EX_ILLEGAL_VALUE);
-    if (ILLEGAL_ADDRESS)    return Result(MB_FC_WRITE_COILS, MB_EX_ILLEGAL_ADDRESS);
+    uint8_t * data = response.begin(MB_FC_READ_FIFO);
+    const uint8_t n = sampler->drain(channel, data + 4, MB_FIFO_MAX);
 
-    const uint16_t reg = actual_addr;
-    uint16_t numCoils = amount;
+    data[0] = 0;
+    data[1] = 2 + 2 * n;
+    data[2] = 0;
+    data[3] = n;
+    response.setDataLen(4 + 2 * n);
+
+    return response.result();
+}
+
+const Result ModmataPeripheral::WriteCoil(const uint16_t address, const uint16_t value) {
+    const bool ILLEGAL_VALUE = !(value == 0xFF00 || value == 0x0000);
+    const bool ILLEGAL_ADDRESS = !_inSpace(address, 1);
+
+    if (ILLEGAL_VALUE) return makeException(MB_FC_WRITE_COIL, MB_EX_ILLEGAL_VALUE);
+    if (ILLEGAL_ADDRESS) return makeException(MB_FC_WRITE_COIL, MB_EX_ILLEGAL_ADDRESS);
+
+    if (coils.set(address, value == 0xFF00))
+        return makeEcho(MB_FC_WRITE_COIL, address, value);
+
+    return makeException(MB_FC_WRITE_COIL, MB_EX_DEVICE_FAILURE);    
+}
 
+const Result ModmataPeripheral::WriteCoils(const uint16_t address, const uint16_t amount, const uint8_t * values) {
     const uint8_t byteCount = values[0];
     const uint8_t * coilVals = values + 1;
 
-    for (int i=0; i < byteCount; i++) {
-        // each byte sent
-        CoilArray ca(coilVals[i]);
+    const bool ILLEGAL_VALUE = !(amount >= 1 && amount <= MB_MAX_WRITE_BITS && byteCount == (amount + 7) / 8);
+    const bool ILLEGAL_ADDRESS = !_inSpace(address, amount);
 
-        const int coilsInLoop = (numCoils >= 8) ? 8 : numCoils;
+    if (ILLEGAL_VALUE)      return makeException(MB_FC_WRITE_COILS, MB_EX_ILLEGAL_VALUE);
+    if (ILLEGAL_ADDRESS)    return makeException(MB_FC_WRITE_COILS, MB_EX_ILLEGAL_ADDRESS);
 
-        for (int j=0; j < coilsInLoop; j++) {
-            const uint16_t curRegister = reg + ((i * 8) + j);
-            const uint16_t asWord = 0xFF00 * ca.coils[7-j];
+    // Packed coil bytes go straight into the bank, no per-coil unpacking
+    if (!coils.writeBits(address, amount, coilVals)) return makeException(MB_FC_WRITE_COILS, MB_EX_DEVICE_FAILURE);
 
-            const bool REGISTER_SET = table.verifySetRegister(curRegister, asWord);
-            if (!REGISTER_SET) DEVICE_FAIL = true;
-        }
+    return makeEcho(MB_FC_WRITE_COILS, address, amount);
+}
 
-        numCoils -= 8;
-    }
+const Result ModmataPeripheral::WriteHolding(const uint16_t address, const uint16_t value) {
+    const bool ILLEGAL_ADDRESS = !_inSpace(address, 1);
+    if (ILLEGAL_ADDRESS) return makeException(MB_FC_WRITE_HOLDING, MB_EX_ILLEGAL_ADDRESS);
 
-    if (DEVICE_FAIL) return Result(MB_FC_WRITE_COILS, MB_EX_DEVICE_FAILURE);
+    // set value
+    const bool REGISTER_SET = holdings.verifySetRegister(address, value);
+    if (!REGISTER_SET) return makeException(MB_FC_WRITE_HOLDING, MB_EX_DEVICE_FAILURE);
 
-    return Result(MB_FC_WRITE_COILS, address, amount);
+    return makeEcho(MB_FC_WRITE_HOLDING, address, value);
 }
 
-const Result ModmataPeripheral::WriteHolding(const uint16_t address, const uint16_t value) {
-    const uint16_t actual_addr = address + 40001;
 
-    const bool ILLEGAL_ADDRESS = !(actual_addr >= 40001 && actual_addr <= 49999);
-    if (ILLEGAL_ADDRESS) return Result(MB_FC_WRITE_HOLDING, MB_EX_ILLEGAL_ADDRESS);
+const Result ModmataPeripheral::WriteHoldings(const uint16_t address, const uint16_t amount, const uint8_t * values) {
+    const uint8_t byteCount = values[0];
+    const uint8_t * registerVals = values + 1;
 
-    // set value
-    const bool REGISTER_SET = table.verifySetRegister(actual_addr, value);
-    if (!REGISTER_SET) return Result(MB_FC_WRITE_HOLDING, MB_EX_DEVICE_FAILURE);
+    const bool ILLEGAL_VALUE = !(amount >= 1 && amount <= 123 && byteCount == amount * 2);
+    const bool ILLEGAL_ADDRESS = !_inSpace(address, amount);
+
+    if (ILLEGAL_VALUE) return makeException(MB_FC_WRITE_HOLDINGS, MB_EX_ILLEGAL_VALUE);
+    if (ILLEGAL_ADDRESS) return makeException(MB_FC_WRITE_HOLDINGS, MB_EX_ILLEGAL_ADDRESS);
 
-    return Result(MB_FC_WRITE_HOLDING, address, value);
+    // Big-endian register data straight from the frame
+    const bool REGISTERS_SET = holdings.writeRange(address, amount, registerVals);
+    if (!REGISTERS_SET) return makeException(MB_FC_WRITE_HOLDINGS, MB_EX_DEVICE_FAILURE);
+
+    return makeEcho(MB_FC_WRITE_HOLDINGS, address, amount);
+}
+
+/**
+ * @brief Set a holding register to (current AND andMask) OR (orMask AND NOT andMask)
+ * 
+ * The read and the write happen in one request, so no other controller can change the register
+ * in between (unlike a read followed by a write).
+ * 
+ * @param address Register to modify
+ * @param andMask Bits to keep
+ * @param orMask Bits to set among the ones not kept
+ * @return const Result 
+ */
+const Result ModmataPeripheral::MaskWriteHolding(const uint16_t address, const uint16_t andMask, const uint16_t orMask) {
+    const bool ILLEGAL_ADDRESS = !_inSpace(address, 1);
+    if (ILLEGAL_ADDRESS) return makeException(MB_FC_MASK_WRITE_HOLDING, MB_EX_ILLEGAL_ADDRESS);
+
+    // Unset registers count as 0, same as for reads
+    const uint16_t current = holdings.getRegisterVal(address);
+    const uint16_t value = (current & andMask) | (orMask & ~andMask);
+
+    if (!holdings.verifySetRegister(address, value)) return makeException(MB_FC_MASK_WRITE_HOLDING, MB_EX_DEVICE_FAILURE);
+
+    // The reply echoes the request: address, AND mask, OR mask
+    uint8_t * data = response.begin(MB_FC_MASK_WRITE_HOLDING);
+    data[0] = highByte(address);    data[1] = lowByte(address);
+    data[2] = highByte(andMask);    data[3] = lowByte(andMask);
+    data[4] = highByte(orMask);     data[5] = lowByte(orMask);
+    response.setDataLen(6u);
+    return response.result();
 }
 
+/**
+ * @brief Write multiple holding registers, then read multiple holding registers, in one request
+ * 
+ * The write goes first, so the read sees it where the ranges overlap.
+ * 
+ * @param readAddress Initial address to read from
+ * @param readAmount Number of registers to read
+ * @param writeAddress Initial address to write to
+ * @param writeAmount Number of registers to write
+ * @param values The request's byte count, followed by the register data
+ * @return const Result 
+ */
+const Result ModmataPeripheral::ReadWriteHoldings(const uint16_t readAddress, const uint16_t readAmount,
+                                                  const uint16_t writeAddress, const uint16_t writeAmount, const uint8_t * values) {
+    // Check the read half too before anything is written, so a bad request changes nothing
+    const bool ILLEGAL_VALUE = !(readAmount >= 1 && readAmount <= 125 && writeAmount >= 1 && writeAmount <= 121);
+    const bool ILLEGAL_ADDRESS = !(_inSpace(readAddress, readAmount) && _inSpace(writeAddress, writeAmount));
 
-const Result ModmataPeripheral::WriteHoldings(const uint16_t address, const uint16_t amount, const uint16_t * values) {
-    const uint16_t actual_addr = address + 40001;
+    if (ILLEGAL_VALUE) return makeException(MB_FC_READ_WRITE_HOLDINGS, MB_EX_ILLEGAL_VALUE);
+    if (ILLEGAL_ADDRESS) return makeException(MB_FC_READ_WRITE_HOLDINGS, MB_EX_ILLEGAL_ADDRESS);
 
-    const bool ILLEGAL_VALUE = !(amount >= 1 && amount <= 125);
-    const bool ILLEGAL_ADDRESS = !(actual_addr >= 40001 && actual_addr <= 49999 && actual_addr + amount <= 49999);
-    bool DEVICE_FAIL = false;
+    const Result written = WriteHoldings(writeAddress, writeAmount, values);
+    if (written.isException()) return response.retag(MB_FC_READ_WRITE_HOLDINGS);
 
-    if (ILLEGAL_VALUE) return Result(MB_FC_WRITE_HOLDINGS, MB_EX_ILLEGAL_VALUE);
-    if (ILLEGAL_ADDRESS) return Result(MB_FC_WRITE_HOLDINGS, MB_EX_ILLEGAL_ADDRESS);
+    ReadHoldings(readAddress, readAmount);
+    return response.retag(MB_FC_READ_WRITE_HOLDINGS);
+}
 
-    for (int i=0; i < amount; i++) {
-        const bool REGISTER_SET = table.verifySetRegister(actual_addr + i, bswap16(values[i]));
-        if (!REGISTER_SET) DEVICE_FAIL = true;
+/**
+ * @brief Run several requests from one frame, in order, and pack their replies into one
+ * 
+ * Request: [count]([len][request PDU]) x count
+ * Reply:   [count run]([len][reply PDU]) x count run
+ * 
+ * Sub-requests go through the same dispatch table as standalone ones, so anything registered can
+ * be batched except another batch. A sub-request that fails gets its exception in its slot and the
+ * rest still run. The batch stops early, before a sub-request whose reply might not fit in what's
+ * left of the frame; the controller sends the ones not run again. (A first sub-request that can't
+ * fit even on its own, like a full 125 register read, fails the whole batch instead.)
+ * 
+ * @param values Sub-request count, then the length-prefixed sub-requests
+ * @param len Length of 'values'
+ * @return const Result 
+ */
+const Result ModmataPeripheral::Batch(const uint8_t * values, const size_t len) {
+    const uint8_t count = values[0];
+
+    // Check the framing of all of it before running any of it
+    size_t pos = 1;
+    for (uint8_t i = 0; i < count; i++) {
+        if (pos >= len || values[pos] == 0 || pos + 1 + values[pos] > len)
+            return makeException(MB_FC_BATCH, MB_EX_ILLEGAL_VALUE);
+        pos += 1 + values[pos];
     }
 
-    if (DEVICE_FAIL) return Result(MB_FC_WRITE_COILS, MB_EX_DEVICE_FAILURE);
+    const bool ILLEGAL_VALUE = (count == 0 || pos != len);
+    if (ILLEGAL_VALUE) return makeException(MB_FC_BATCH, MB_EX_ILLEGAL_VALUE);
+
+    // Each sub-reply is built in place right behind the previous one
+    size_t out = 2;     // [function code][count run]
+    uint8_t run = 0;
+    pos = 1;
+
+    while (run < count) {
+        const uint8_t subLen = values[pos];
+        const uint8_t * sub = values + pos + 1;
+        const bool nested = (sub[0] == MB_FC_BATCH);
 
-    return Result(MB_FC_WRITE_HOLDINGS, address, amount);
+        if (out + 1 + (nested ? 2 : replyBound(sub, subLen)) > MB_PDU_MAX) {
+            // Even the first one can't fit: it never will, so running the rest isn't an option either
+            if (run == 0) return makeException(MB_FC_BATCH, MB_EX_ILLEGAL_VALUE);
+            break;
+        }
+
+        response.setOrigin(out + 1);
+        const Result r = nested ? makeException(MB_FC_BATCH, MB_EX_ILLEGAL_FUNCTION) : dispatch(sub, subLen);
+        response.setOrigin(0);
+
+        // A reply past its bound breaks the handler's contract (see registerFunction()): it has already
+        // been written past the end of the frame, so nothing here makes that safe. All this does is keep
+        // a batch with a torn reply in it from going out.
+        if (out + 1 + r.LEN > MB_PDU_MAX) return makeException(MB_FC_BATCH, MB_EX_DEVICE_FAILURE);
+
+        response.pdu()[out] = uint8_t(r.LEN);
+        out += 1 + r.LEN;
+        pos += 1 + subLen;
+        run++;
+    }
+
+    uint8_t * data = response.begin(MB_FC_BATCH);
+    data[0] = run;
+    response.setDataLen(out - 1);
+    return response.result();
 }
 
 // TODO
 const Result ModmataPeripheral::PinMode(const uint8_t pin, uint8_t mode) {
     const bool ILLEGAL_VALUE = (mode != INPUT && mode != INPUT_PULLUP && mode != OUTPUT);
     
-    if (ILLEGAL_VALUE) return Result(MB_FC_PINMODE, MB_EX_ILLEGAL_VALUE);
+    if (ILLEGAL_VALUE) return makeException(MB_FC_PINMODE, MB_EX_ILLEGAL_VALUE);
 
     pinMode(pin, mode);
 
-    return Result(MB_FC_PINMODE, pin, mode);
+    return makeEcho(MB_FC_PINMODE, pin, mode);
 }
 
 // TODO
 const Result ModmataPeripheral::DigitalRead(const uint8_t pin) const {
     const uint16_t val = (0xFF00 * digitalRead(pin));
 
-    return Result(MB_FC_DIGITAL_READ, pin, val);
+    return makeEcho(MB_FC_DIGITAL_READ, pin, val);
 }
 
 // TODO
 const Result ModmataPeripheral::AnalogRead(const uint8_t pin) const {
     const uint16_t val = analogRead(pin);
 
-    return Result(MB_FC_ANALOG_READ, pin, val);
+    return makeEcho(MB_FC_ANALOG_READ, pin, val);
 }
 
 // TODO
@@ -291,22 +770,384 @@ const Result ModmataPeripheral::DigitalWrite(const uint8_t pin, const uint8_t va
     const bool ILLEGAL_VALUE = (value != HIGH && value != LOW);
     const bool ILLEGAL_ADDRESS = (digitalPinToPort(pin) == NOT_A_PIN);
 
-    if (ILLEGAL_VALUE) return Result(MB_FC_DIGITAL_WRITE, MB_EX_ILLEGAL_VALUE);
-    if (ILLEGAL_ADDRESS) return Result(MB_FC_DIGITAL_WRITE, MB_EX_ILLEGAL_ADDRESS);
+    if (ILLEGAL_VALUE) return makeException(MB_FC_DIGITAL_WRITE, MB_EX_ILLEGAL_VALUE);
+    if (ILLEGAL_ADDRESS) return makeException(MB_FC_DIGITAL_WRITE, MB_EX_ILLEGAL_ADDRESS);
 
     digitalWrite(pin, value);
 
-    return Result(MB_FC_DIGITAL_WRITE, pin, value);
+    return makeEcho(MB_FC_DIGITAL_WRITE, pin, value);
 }
 
 // TODO
 const Result ModmataPeripheral::AnalogWrite(const uint8_t pin, const uint16_t value) {
     const bool ILLEGAL_ADDRESS = (pin == NOT_A_PIN);
 
-    if (ILLEGAL_ADDRESS) return Result(MB_FC_ANALOG_WRITE, MB_EX_ILLEGAL_ADDRESS);
+    if (ILLEGAL_ADDRESS) return makeException(MB_FC_ANALOG_WRITE, MB_EX_ILLEGAL_ADDRESS);
 
     analogWrite(pin, (int)value);
 
-    return Result(MB_FC_ANALOG_WRITE, pin, value);
+    return makeEcho(MB_FC_ANALOG_WRITE, pin, value);
+}
+
+#ifdef portOutputRegister
+
+// digitalPinToPort() has no inverse and portOutputRegister() no range check, so a port is only
+// accepted if some pin maps to it
+static const bool _isPort(const uint8_t port) {
+    if (port == NOT_A_PORT) return false;
+    for (uint8_t pin = 0; pin < NUM_DIGITAL_PINS; pin++)
+        if (digitalPinToPort(pin) == port) return true;
+    return false;
+}
+
+/**
+ * @brief Read every pin of a port at once from its input register
+ * 
+ * @param port Port number as returned by digitalPinToPort()
+ * @return const Result [port][pin levels] 
+ */
+const Result ModmataPeripheral::PortRead(const uint8_t port) const {
+    if (!_isPort(port)) return makeException(MB_FC_PORT_READ, MB_EX_ILLEGAL_ADDRESS);
+
+    const uint16_t levels = *portInputRegister(port);
+
+    return makeEcho(MB_FC_PORT_READ, port, levels);
+}
+
+/**
+ * @brief Set the outputs in 'mask' on a port to the matching bits of 'value', all on the same edge
+ * 
+ * The pins must already be outputs (see PinMode). Bits outside 'mask' are left alone.
+ * 
+ * @param port Port number as returned by digitalPinToPort()
+ * @param mask Pins to change, one bit per pin of the port
+ * @param value New levels for those pins
+ * @return const Result 
+ */
+const Result ModmataPeripheral::PortWrite(const uint8_t port, const uint16_t mask, const uint16_t value) {
+    // Only a known port may be looked up: the board's tables are indexed by it unchecked
+    if (!_isPort(port)) return makeException(MB_FC_PORT_WRITE, MB_EX_ILLEGAL_ADDRESS);
+
+    auto out = portOutputRegister(port);
+
+    const bool ILLEGAL_VALUE = (sizeof(*out) < sizeof(mask)) && (mask >> (8 * sizeof(*out))) != 0;
+
+    if (ILLEGAL_VALUE) return makeException(MB_FC_PORT_WRITE, MB_EX_ILLEGAL_VALUE);
+
+    // A single store to the output register; masked so an ISR can't change the port between the read and it
+    noInterrupts();
+    *out = (*out & ~mask) | (value & mask);
+    interrupts();
+
+    uint8_t * data = response.begin(MB_FC_PORT_WRITE);
+    data[0] = port;
+    data[1] = highByte(mask);   data[2] = lowByte(mask);
+    data[3] = highByte(value);  data[4] = lowByte(value);
+    response.setDataLen(5u);
+    return response.result();
+}
+
+#endif // portOutputRegister
+
+// I2C bridge
+//
+// The peripheral drives the I2C bus as its controller on the Modbus controller's behalf. Transfers
+// are refused until the bus has been started (0x46/0x47) so an unstarted TWI can't hang the sketch.
+
+/**
+ * @brief Join the I2C bus as a peripheral at 'address' (Wire.begin(address))
+ * 
+ * Controller transfers keep working afterwards, as on a multi-controller bus.
+ * 
+ * @param address 7-bit address, 0x08..0x77
+ * @return const Result [address]
+ */
+const Result ModmataPeripheral::WireBeginPeripheral(const uint8_t address) {
+    const bool ILLEGAL_ADDRESS = !(address >= 0x08 && address <= 0x77);
+    if (ILLEGAL_ADDRESS) return makeException(MB_FC_WIRE_BEGIN_PERIPHERAL, MB_EX_ILLEGAL_ADDRESS);
+
+    wire->begin(address);
+    wireMode = MODE_PERIPHERAL;
+
+    uint8_t * data = response.begin(MB_FC_WIRE_BEGIN_PERIPHERAL);
+    data[0] = address;
+    response.setDataLen(1u);
+    return response.result();
+}
+
+/**
+ * @brief Join the I2C bus as its controller (Wire.begin())
+ * 
+ * @return const Result (no data)
+ */
+const Result ModmataPeripheral::WireBeginController() {
+    wire->begin();
+    wireMode = MODE_CONTROLLER;
+
+    response.begin(MB_FC_WIRE_BEGIN_CONTROLLER);
+    return response.result();
 }
 
+/**
+ * @brief Leave the I2C bus (Wire.end())
+ * 
+ * @return const Result (no data)
+ */
+const Result ModmataPeripheral::WireEnd() {
+    if (wireMode != 0) wire->end();
+    wireMode = 0;
+
+    response.begin(MB_FC_WIRE_END);
+    return response.result();
+}
+
+/**
+ * @brief Set the I2C clock (Wire.setClock())
+ * 
+ * @param clock SCL frequency in Hz, 10 kHz to 3.4 MHz
+ * @return const Result [clock: 4 bytes]
+ */
+const Result ModmataPeripheral::WireClock(const uint32_t clock) {
+    const bool ILLEGAL_VALUE = !(clock >= 10000ul && clock <= 3400000ul);
+
+    if (wireMode == 0)  return makeException(MB_FC_WIRE_CLK, MB_EX_ILLEGAL_FUNCTION);
+    if (ILLEGAL_VALUE)  return makeException(MB_FC_WIRE_CLK, MB_EX_ILLEGAL_VALUE);
+
+    wire->setClock(clock);
+
+    uint8_t * data = response.begin(MB_FC_WIRE_CLK);
+    data[0] = uint8_t(clock >> 24);     data[1] = uint8_t(clock >> 16);
+    data[2] = uint8_t(clock >> 8);      data[3] = uint8_t(clock);
+    response.setDataLen(4u);
+    return response.result();
+}
+
+/**
+ * @brief Read 'count' bytes from the I2C device at 'address'
+ * 
+ * @param address 7-bit device address
+ * @param count Bytes to read, 1..MB_WIRE_BUFFER
+ * @return const Result [count][bytes ...]
+ */
+const Result ModmataPeripheral::WireRead(const uint8_t address, const uint8_t count) {
+    const bool ILLEGAL_ADDRESS = !(address <= 0x7F);
+    const bool ILLEGAL_VALUE = !(count >= 1 && count <= MB_WIRE_BUFFER);
+
+    if (wireMode == 0)      return makeException(MB_FC_WIRE_READ, MB_EX_ILLEGAL_FUNCTION);
+    if (ILLEGAL_ADDRESS)    return makeException(MB_FC_WIRE_READ, MB_EX_ILLEGAL_ADDRESS);
+    if (ILLEGAL_VALUE)      return makeException(MB_FC_WIRE_READ, MB_EX_ILLEGAL_VALUE);
+
+    // Nothing comes back from a device that doesn't acknowledge its address
+    if (wire->requestFrom(address, count, uint8_t(true)) != count)
+        return makeException(MB_FC_WIRE_READ, MB_EX_GATEWAY_TARGET);
+
+    uint8_t * array = response.beginBytes(MB_FC_WIRE_READ, count);
+    for (uint8_t i = 0; i < count; i++) array[i] = wire->read();
+
+    return response.result();
+}
+
+/**
+ * @brief Write 'count' bytes to the I2C device at 'address'
+ * 
+ * @param address 7-bit device address
+ * @param count Bytes to write, 1..MB_WIRE_BUFFER
+ * @param values The bytes
+ * @return const Result [address][count]
+ */
+const Result ModmataPeripheral::WireWrite(const uint8_t address, const uint8_t count, const uint8_t * values) {
+    const bool ILLEGAL_ADDRESS = !(address <= 0x7F);
+    const bool ILLEGAL_VALUE = !(count >= 1 && count <= MB_WIRE_BUFFER);
+
+    if (wireMode == 0)      return makeException(MB_FC_WIRE_WRITE, MB_EX_ILLEGAL_FUNCTION);
+    if (ILLEGAL_ADDRESS)    return makeException(MB_FC_WIRE_WRITE, MB_EX_ILLEGAL_ADDRESS);
+    if (ILLEGAL_VALUE)      return makeException(MB_FC_WIRE_WRITE, MB_EX_ILLEGAL_VALUE);
+
+    wire->beginTransmission(address);
+    wire->write(values, count);
+    const uint8_t status = wire->endTransmission(uint8_t(true));
+
+    // 2/3: address/data not acknowledged; anything else is the bus itself failing
+    if (status == 2 || status == 3) return makeException(MB_FC_WIRE_WRITE, MB_EX_GATEWAY_TARGET);
+    if (status != 0)                return makeException(MB_FC_WIRE_WRITE, MB_EX_DEVICE_FAILURE);
+
+    uint8_t * data = response.begin(MB_FC_WIRE_WRITE);
+    data[0] = address;
+    data[1] = count;
+    response.setDataLen(2u);
+    return response.result();
+}
+
+/**
+ * @brief Run several I2C transfers from one request
+ * 
+ * Request:  [count] ([address][write count][bytes ...][read count]) ...
+ * Reply:    [count] ([status][read count][bytes ...]) ...
+ * 
+ * Each transaction writes its bytes (if any), then reads with a repeated start (if it reads
+ * anything), so "set the register pointer, read the registers" is one transaction. A transaction
+ * with nothing to write or read just checks that the address acknowledges. Status is the Wire
+ * library's: 0 done, 2 address not acknowledged, 3 data not acknowledged, others a bus failure;
+ * a failed transaction reads nothing but doesn't stop the ones after it.
+ * 
+ * @param values Request data, starting at the transaction count
+ * @param len Length of 'values'
+ * @return const Result 
+ */
+const Result ModmataPeripheral::WireTransactions(const uint8_t * values, const size_t len) {
+    const uint8_t count = values[0];
+
+    if (wireMode == 0) return makeException(MB_FC_WIRE_TRANSACTIONS, MB_EX_ILLEGAL_FUNCTION);
+
+    // Check all of it, and that every reply fits, before touching the bus
+    size_t pos = 1;
+    size_t replyLen = 1;
+    for (uint8_t i = 0; i < count; i++) {
+        if (pos + 2 > len || pos + 3u + values[pos + 1] > len)
+            return makeException(MB_FC_WIRE_TRANSACTIONS, MB_EX_ILLEGAL_VALUE);
+
+        const uint8_t address = values[pos];
+        const uint8_t writeCount = values[pos + 1];
+        const uint8_t readCount = values[pos + 2 + writeCount];
+
+        if (address > 0x7F) return makeException(MB_FC_WIRE_TRANSACTIONS, MB_EX_ILLEGAL_ADDRESS);
+        if (writeCount > MB_WIRE_BUFFER || readCount > MB_WIRE_BUFFER)
+            return makeException(MB_FC_WIRE_TRANSACTIONS, MB_EX_ILLEGAL_VALUE);
+
+        pos += 3u + writeCount;
+        replyLen += 2u + readCount;
+    }
+    if (count == 0 || pos != len || replyLen > MB_PDU_MAX - 1)
+        return makeException(MB_FC_WIRE_TRANSACTIONS, MB_EX_ILLEGAL_VALUE);
+
+    uint8_t * out = response.begin(MB_FC_WIRE_TRANSACTIONS);
+    out[0] = count;
+    size_t o = 1;
+
+    pos = 1;
+    for (uint8_t i = 0; i < count; i++) {
+        const uint8_t address = values[pos];
+        const uint8_t writeCount = values[pos + 1];
+        const uint8_t * bytes = values + pos + 2;
+        const uint8_t readCount = bytes[writeCount];
+        pos += 3u + writeCount;
+
+        uint8_t status = 0;
+        uint8_t got = 0;
+
+        // Keep the bus for the read that follows: repeated start instead of stop
+        if (writeCount > 0 || readCount == 0) {
+            wire->beginTransmission(address);
+            if (writeCount > 0) wire->write(bytes, writeCount);
+            status = wire->endTransmission(uint8_t(readCount == 0));
+        }
+
+        if (status == 0 && readCount > 0) {
+            got = wire->requestFrom(address, readCount, uint8_t(true));
+            if (got != readCount) status = 2;
+            for (uint8_t j = 0; j < got; j++) out[o + 2 + j] = wire->read();
+        }
+
+        out[o] = status;
+        out[o + 1] = got;
+        o += 2u + got;
+    }
+
+    response.setDataLen(o);
+    return response.result();
+}
+
+// SPI bridge
+
+/**
+ * @brief Start the SPI bus (SPI.begin())
+ * 
+ * @return const Result (no data)
+ */
+const Result ModmataPeripheral::SpiBegin() {
+    spi->begin();
+    spiBegun = true;
+
+    response.begin(MB_FC_SPI_BEGIN);
+    return response.result();
+}
+
+/**
+ * @brief Stop the SPI bus (SPI.end())
+ * 
+ * @return const Result (no data)
+ */
+const Result ModmataPeripheral::SpiEnd() {
+    if (spiBegun) spi->end();
+    spiBegun = false;
+
+    response.begin(MB_FC_SPI_END);
+    return response.result();
+}
+
+/**
+ * @brief Choose the chip select pin and bus settings for the transfers that follow
+ * 
+ * @param csPin Pin driven low for each transfer, or MB_SPI_NO_CS
+ * @param clock Maximum SCK frequency in Hz
+ * @param bitOrder 0 LSB first, 1 MSB first
+ * @param mode SPI mode, 0..3
+ * @return const Result [chip select][clock: 4 bytes][bit order][mode]
+ */
+const Result ModmataPeripheral::SpiSettings(const uint8_t csPin, const uint32_t clock, const uint8_t bitOrder, const uint8_t mode) {
+    static const uint8_t modes[] = {SPI_MODE0, SPI_MODE1, SPI_MODE2, SPI_MODE3};
+
+    const bool ILLEGAL_ADDRESS = !(csPin < NUM_DIGITAL_PINS || csPin == MB_SPI_NO_CS);
+    const bool ILLEGAL_VALUE = !(clock > 0 && bitOrder <= 1 && mode <= 3);
+
+    if (ILLEGAL_ADDRESS)    return makeException(MB_FC_SPI_SETTINGS, MB_EX_ILLEGAL_ADDRESS);
+    if (ILLEGAL_VALUE)      return makeException(MB_FC_SPI_SETTINGS, MB_EX_ILLEGAL_VALUE);
+
+    spi_settings = SPISettings(clock, bitOrder ? MSBFIRST : LSBFIRST, modes[mode]);
+
+    // Deselect the new device before anything is clocked out
+    spiCs = csPin;
+    if (spiCs != MB_SPI_NO_CS) {
+        digitalWrite(spiCs, HIGH);
+        pinMode(spiCs, OUTPUT);
+    }
+
+    uint8_t * data = response.begin(MB_FC_SPI_SETTINGS);
+    data[0] = csPin;
+    data[1] = uint8_t(clock >> 24);     data[2] = uint8_t(clock >> 16);
+    data[3] = uint8_t(clock >> 8);      data[4] = uint8_t(clock);
+    data[5] = bitOrder;
+    data[6] = mode;
+    response.setDataLen(7u);
+    return response.result();
+}
+
+/**
+ * @brief Clock 'count' bytes out and the same number back in, full duplex
+ * 
+ * The bytes to send are placed where the reply's data goes and transferred in place, so what
+ * was received replaces them and goes straight back out: up to 252 bytes per frame with no
+ * buffer in between.
+ * 
+ * @param values Bytes to send
+ * @param count How many, 1..MB_PDU_MAX-1
+ * @return const Result [received bytes ...]
+ */
+const Result ModmataPeripheral::SpiTransfer(const uint8_t * values, const size_t count) {
+    const bool ILLEGAL_VALUE = !(count >= 1 && count <= MB_PDU_MAX - 1);
+
+    if (!spiBegun)      return makeException(MB_FC_SPI_TRANSFER, MB_EX_ILLEGAL_FUNCTION);
+    if (ILLEGAL_VALUE)  return makeException(MB_FC_SPI_TRANSFER, MB_EX_ILLEGAL_VALUE);
+
+    uint8_t * data = response.begin(MB_FC_SPI_TRANSFER);
+    memcpy(data, values, count);
+
+    spi->beginTransaction(spi_settings);
+    if (spiCs != MB_SPI_NO_CS) digitalWrite(spiCs, LOW);
+    spi->transfer(data, count);
+    if (spiCs != MB_SPI_NO_CS) digitalWrite(spiCs, HIGH);
+    spi->endTransaction();
+
+    response.setDataLen(count);
+    return response.result();
+}
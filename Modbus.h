@@ -17,7 +17,12 @@
 #include <math.h>
 
 #include "registers.h"
+#include "bitbank.h"
+#include "regmap.h"
 #include "frame.h"
+#include "telemetry.h"
+#include "compress.h"
+#include "sampler.h"
 #include "constants.h"
 #include "etc.h"
 
@@ -35,14 +40,145 @@ enum I2C_MODE {
     MODE_PERIPHERAL = 2u
 };
 
+// Chip select pin value for "none" (the device's select is tied low, or handled by the sketch)
+#define MB_SPI_NO_CS        0xFF
+
+// Most bytes one I2C transfer can carry (the Wire library's buffer)
+#ifndef MB_WIRE_BUFFER
+#ifdef BUFFER_LENGTH
+#define MB_WIRE_BUFFER      BUFFER_LENGTH
+#else
+#define MB_WIRE_BUFFER      32
+#endif
+#endif
+
+// What became of a received frame (counted per state in the telemetry block)
+enum RX_STATE {
+    STATE_IDLE = 0,         // no complete frame yet (rxADU() returned without waiting)
+    STATE_RXERROR = 1,
+    STATE_BADCRC = 2,
+    STATE_NOTRECIPIENT = 3,
+    STATE_BADFUNCTION = 4,
+    STATE_TIMEOUT = 5,
+    STATE_BROADCAST = 6,
+    STATE_NORMAL = 7,
+};
+
+// Table-driven dispatch
+//
+// Every function code the peripheral handles has an entry in a table indexed by the code. The
+// entry says how the request's fields are laid out, so the length check and the field parsing are
+// done once in dispatch() for every function, and the handler gets them already decoded.
+
+#ifndef MB_FC_TABLE_SIZE
+#define MB_FC_TABLE_SIZE    0x80    // function codes 0x00..0x7F; 0x80 and up are exception replies
+#endif
+
+// The built-in functions are a const table (in flash on AVR); only what registerFunction() and
+// unregisterFunction() change takes RAM, one slot per function code changed
+#ifndef MB_FC_OVERRIDES
+#ifdef ARDUINO
+#define MB_FC_OVERRIDES     4
+#else
+#define MB_FC_OVERRIDES     16
+#endif
+#endif
+
+enum FIELD_LAYOUT {
+    LAYOUT_RAW = 0,             // [data ...]                       handler parses 'data' itself
+    LAYOUT_ADDR_COUNT,          // [address][count]
+    LAYOUT_ADDR_VALUE,          // [address][value]
+    LAYOUT_ADDR_COUNT_BYTES,    // [address][count][byte count][bytes ...]
+    LAYOUT_PIN,                 // [pin]
+    LAYOUT_PIN_BYTE,            // [pin][value]
+    LAYOUT_PIN_WORD,            // [pin][value hi][value lo]
+    LAYOUT_ADDR_BITS,           // [address][count], count in bits (coil/discrete reads)
+    LAYOUT_ADDR,                // [address]
+};
+
+// Shortest PDU (function code included) for each FIELD_LAYOUT
+static const uint8_t layoutMinLength[] = {1, 5, 5, 6, 2, 3, 4, 5, 3};
+
+// A request's fields as decoded by dispatch(); which of them are set depends on the layout
+struct RequestFields {
+    uint8_t         code = 0;
+    uint16_t        address = 0;    // register address, or pin
+    uint16_t        value = 0;      // count, or value
+    const uint8_t * data = nullptr; // LAYOUT_ADDR_COUNT_BYTES: the byte count and the bytes after it
+    size_t          len = 0;        //   LAYOUT_RAW: everything after the function code
+};
+
+class ModmataPeripheral;
+typedef const Result (*FunctionHandler)(ModmataPeripheral& peripheral, const RequestFields& request);
+
+// Longest reply to 'pdu', for functions whose reply size the request decides ('len' >= min length)
+typedef const size_t (*ReplyBound)(const uint8_t * pdu, const size_t len);
+
+// No default member initializers, so the built-in table can be constant-initialized (C++11)
+struct FunctionEntry {
+    uint8_t         code;           // 0 for a free override slot
+    FunctionHandler handler;        // nullptr in an override: the built-in function was unregistered
+    uint8_t         layout;
+    uint8_t         minLength;      // shortest acceptable PDU (0: the layout's own)
+    uint8_t         maxReply;       // longest reply PDU (see replyBound()); 0 for unknown
+    ReplyBound      bound;          // built-in functions only: the reply size from the request, or nullptr
+};
+
 class ModmataPeripheral {
     public:
-        RegisterArray   table;
+        RegisterArray   inputs;         // input registers (3xxxx), keyed by protocol address
+        RegisterArray   holdings;       // holding registers (4xxxx), likewise
+        BitBank         coils;
+        BitBank         discretes;
         SPISettings     spi_settings;
-        Packet          lastPacket{Packet(255)};
+        Telemetry       telemetry;      // served as input registers from MB_TELEMETRY_BASE
+
+        // Every handler builds its reply in here; the Result it returns points into this frame
+        mutable ResponseWriter response;
 
         ModmataPeripheral() {}
 
+        // Handle function code 'code' with 'handler' (replacing any earlier handler, built-in ones
+        // included). Requests shorter than the layout needs, or than 'minLength', are rejected with
+        // an illegal value exception before the handler runs. 'maxReply' is the longest reply PDU the
+        // handler builds (0 for unknown, taken as MB_PDU_MAX); Batch uses it to tell whether a reply fits.
+        // Building a longer one breaks that contract: inside a batch the reply is written straight into
+        // the rest of the frame, and one past its bound runs off the end of it.
+        // False once MB_FC_OVERRIDES codes have been changed.
+        const bool registerFunction(const uint8_t code, const FIELD_LAYOUT layout, FunctionHandler handler,
+                                    const uint8_t minLength = 0, const uint8_t maxReply = 0);
+        const void unregisterFunction(const uint8_t code);
+        const bool functionAvailable(const uint8_t code) const { FunctionEntry f; return lookup(code, f); }
+
+        // The table behind a 16-bit register space (MB_REGISTER_INPUT or MB_REGISTER_HOLDING)
+        RegisterArray& registers(const uint8_t space) { return space == MB_REGISTER_INPUT ? inputs : holdings; }
+        const RegisterArray& registers(const uint8_t space) const { return space == MB_REGISTER_INPUT ? inputs : holdings; }
+
+        // Serve part of the register map from compile-time storage (see regmap.h)
+        template <REGISTER_T TYPE, uint16_t FIRST, uint16_t COUNT, uint16_t... VALUES>
+        const void attach(StaticRegisterMap<TYPE, FIRST, COUNT, VALUES...>& map) { registers(TYPE).attach(map); }
+        const void attach(const REGISTER_T space, RegisterBlock& block) { registers(space).attach(block); }
+
+        template <REGISTER_T TYPE, uint16_t COUNT, uint8_t... PACKED>
+        const void attach(StaticBitMap<TYPE, COUNT, PACKED...>& map) {
+            (TYPE == MB_REGISTER_COIL ? coils : discretes).useStorage(map.storage, COUNT);
+        }
+
+        // Resolve a range of addresses through callbacks at request time (see BoundRange in regmap.h)
+        template <REGISTER_T TYPE, uint16_t FIRST, uint16_t COUNT>
+        const void bind(BoundRange<TYPE, FIRST, COUNT>& range) {
+            if (TYPE == MB_REGISTER_COIL)           coils.bind(range);
+            else if (TYPE == MB_REGISTER_DISCRETE)  discretes.bind(range);
+            else                                    registers(TYPE).bind(range);
+        }
+
+        // Serve 'sampler' as input registers from MB_SAMPLER_BASE and as FIFOs (see sampler.h)
+        const void attach(AnalogSampler& sampler) { this->sampler = &sampler; }
+
+        // Run the request PDU 'pdu' (function code first) and build the reply in 'response'.
+        // Transports call this with whatever they framed; execute() times it into 'telemetry'.
+        const Result execute(const uint8_t * pdu, const size_t len);
+
         // Basic Modbus functionality
 
         const Result ReadCoil(         const uint16_t address                          ) const;
@@ -53,11 +189,24 @@ class ModmataPeripheral {
         const Result ReadHoldings(     const uint16_t address, const uint16_t amount   ) const;
         const Result ReadInput(        const uint16_t address                          ) const;
         const Result ReadInputs(       const uint16_t address, const uint16_t amount   ) const;
+        const Result ReadFifo(         const uint16_t pointerAddress);
+        // Registers of one space (MB_REGISTER_INPUT/HOLDING) changed after change number 'since',
+        // from protocol address 'start' on
+        const Result ReadChanges(      const uint8_t space, const uint32_t since, const uint16_t start);
+        // Read Inputs/Holdings ('space' MB_REGISTER_INPUT/HOLDING) with the reply coded by compress.h
+        const Result ReadCompressed(   const uint8_t space, const uint16_t address, const uint16_t amount) const;
 
         const Result WriteCoil(        const uint16_t address, const uint16_t value);
+        // 'values' starts at the request's byte count, followed by the packed coils/register data
         const Result WriteCoils(       const uint16_t address, const uint16_t amount, const uint8_t * values);
         const Result WriteHolding(     const uint16_t address, const uint16_t value);
-        const Result WriteHoldings(    const uint16_t address, const uint16_t amount, const uint16_t * values);
+        const Result WriteHoldings(    const uint16_t address, const uint16_t amount, const uint8_t * values);
+        const Result MaskWriteHolding( const uint16_t address, const uint16_t andMask, const uint16_t orMask);
+        const Result ReadWriteHoldings(const uint16_t readAddress, const uint16_t readAmount,
+                                       const uint16_t writeAddress, const uint16_t writeAmount, const uint8_t * values);
+
+        // Several requests from one PDU; 'values' starts at the sub-request count
+        const Result Batch(            const uint8_t * values, const size_t len);
 
         // Extended functions
         const Result PinMode(          const uint8_t pin, const uint8_t mode);
@@ -65,26 +214,75 @@ class ModmataPeripheral {
         const Result AnalogRead(       const uint8_t pin) const;
         const Result DigitalWrite(     const uint8_t pin, const uint8_t value);
         const Result AnalogWrite(      const uint8_t pin, const uint16_t value);
+        const Result PortRead(         const uint8_t port) const;
+        const Result PortWrite(        const uint8_t port, const uint16_t mask, const uint16_t value);
+
+        // I2C bridge, through 'wire' (Wire unless useWire() says otherwise)
+        const void useWire(TwoWire& wire) { this->wire = &wire; }
+        const Result WireBeginPeripheral(const uint8_t address);
+        const Result WireBeginController();
+        const Result WireEnd();
+        const Result WireClock(        const uint32_t clock);
+        const Result WireRead(         const uint8_t address, const uint8_t count);
+        const Result WireWrite(        const uint8_t address, const uint8_t count, const uint8_t * values);
+        // Several transfers from one PDU; 'values' starts at the transaction count
+        const Result WireTransactions( const uint8_t * values, const size_t len);
+
+        // SPI bridge, through 'spi' (SPI unless useSPI() says otherwise), with 'spi_settings'
+        const void useSPI(SPIClass& spi) { this->spi = &spi; }
+        const Result SpiBegin();
+        const Result SpiEnd();
+        const Result SpiSettings(      const uint8_t csPin, const uint32_t clock, const uint8_t bitOrder, const uint8_t mode);
+        const Result SpiTransfer(      const uint8_t * values, const size_t count);
 
         const void printThing(const Result& r) {
             Serial.println("---");
-            lastPacket.updateFromResult(r);
-            lastPacket.print();
-            this->table.printRegisters();
+            printBytes(r.DATA, r.LEN);
+            this->inputs.printRegisters();
+            this->holdings.printRegisters();
+            this->coils.printBits();
             Serial.println("---");
         }
 
     protected:
+        FunctionEntry   overrides[MB_FC_OVERRIDES] = {};    // registered/unregistered codes, see lookup()
+        AnalogSampler * sampler = nullptr;
+        TwoWire *       wire = &Wire;
+        uint8_t         wireMode = 0;       // I2C_MODE once begun, 0 before
+        SPIClass *      spi = &SPI;
+        bool            spiBegun = false;
+        uint8_t         spiCs = MB_SPI_NO_CS;
+
+        // The entry in force for 'code' (an override, else the built-in one), with its min length and
+        // reply bound filled in; false if the code isn't handled
+        const bool lookup(const uint8_t code, FunctionEntry& f) const;
+        FunctionEntry * overrideFor(const uint8_t code);
+
+        const Result dispatch(const uint8_t * pdu, const size_t len);
+        const size_t replyBound(const uint8_t * pdu, const size_t len) const;
 
-        // Convert a range of 1-bit registers to a byte (Read Coils, Discretes)
-        const uint8_t rangeToByte(const uint16_t address, const uint8_t count) const {
-            bool vals[8] = {0,0,0,0,0,0,0,0};
+        // Whether the reply to 'pdu' only depends on stored values, so a ResponseCache may keep it
+        const bool cacheable(const uint8_t * pdu, const size_t len) const;
 
-            for (int i=0; i < (count); i++) {
-                vals[i] = table.getRegisterVal(address + i);
+        // Register 'offset' of the telemetry block (see telemetry.h)
+        const uint16_t telemetryWord(const uint16_t offset) const {
+            switch (offset) {
+                case 3:  return inputs.size() + holdings.size();
+                case 4:  return coils.size();
+                case 5:  return discretes.size();
+                default: return telemetry.word(offset);
             }
-            
-            return boolsToByte(vals);
+        }
+
+    public:
+
+        // Reply builders, all writing into 'response' (also for registered handlers)
+        const Result makeException(const uint8_t function, const uint8_t exception) const {
+            return response.exception(function, exception);
+        }
+
+        const Result makeEcho(const uint8_t function, const uint16_t w0, const uint16_t w1) const {
+            return response.words(function, w0, w1);
         }
 
 };
@@ -10,136 +10,125 @@ const bool SerialModmata::config(Stream& stream, unsigned long baud, unsigned in
     this->serialStream = stream;
     this->serialFormat = fmt;
     this->serialBaudRate = baud;
+    receiver.setBaud(baud);
+    return true;
 }
 
-const FunctionStruct& SerialModmata::execute() {
-    switch (currentPacket.pdu.CODE) {
-        // i think this is a bit easier to understand?
-        // 'wordAtOffset()' equivalent to 'bswap16(*(uint16_t *)(currentPacket.pdu.DATA + i));'
-        // use bswap16 because little-endian is LSB first and Modbus sends data MSB first (save for the CRC)
-        
-        // also yes I know these 'break's are mostly redundant, I'm just trying to be careful in case 
-        // return doesn't work like it usually does
-
-        case MB_FC_READ_COILS: {
-            uint16_t address = bswap16(wordAtOffset(currentPacket.pdu.DATA, 0));
-            uint16_t amount = bswap16(wordAtOffset(currentPacket.pdu.DATA, 2));
-            return ReadCoils(address, amount);
-            break;
-        }
-
-        case MB_FC_READ_DISCRETES: {
-            uint16_t address = 10000 + bswap16(wordAtOffset(currentPacket.pdu.DATA, 0));
-            uint16_t amount = bswap16(wordAtOffset(currentPacket.pdu.DATA, 2));
-            return ReadDiscretes(address, amount);
-            break;
-        }
+const void SerialModmata::setDriverEnablePin(const int16_t pin) {
+    dePin = pin;
+    if (dePin >= 0) { pinMode(dePin, OUTPUT); digitalWrite(dePin, LOW); }
+}
 
-        case MB_FC_READ_HOLDINGS: {
-            uint16_t address = 40000 + bswap16(wordAtOffset(currentPacket.pdu.DATA, 0));
-            uint16_t amount = bswap16(wordAtOffset(currentPacket.pdu.DATA, 2));
-            return ReadHoldings(address, amount);
-            break;
-        }
+// Cache invalidation: each space reports its own changes by protocol address
+static void _inputsChanged(void * context, const uint16_t address, const uint16_t count) {
+    ((SerialModmata *)context)->cache.invalidate(MB_FC_READ_INPUTS, address, count);
+}
 
-        case MB_FC_READ_INPUTS: {
-            uint16_t address = 30000 + bswap16(wordAtOffset(currentPacket.pdu.DATA, 0));
-            uint16_t amount = bswap16(wordAtOffset(currentPacket.pdu.DATA, 2));
-            return ReadInputs(address, amount);
-            break;
-        }
+static void _holdingsChanged(void * context, const uint16_t address, const uint16_t count) {
+    ((SerialModmata *)context)->cache.invalidate(MB_FC_READ_HOLDINGS, address, count);
+}
 
-        case MB_FC_WRITE_COIL: {
-            uint16_t address = bswap16(wordAtOffset(currentPacket.pdu.DATA, 0));
-            uint16_t value = bswap16(wordAtOffset(currentPacket.pdu.DATA, 2));
-            return WriteCoil(address, value);
-            break;
-        }
+static void _coilsChanged(void * context, const uint16_t address, const uint16_t count) {
+    ((SerialModmata *)context)->cache.invalidate(MB_FC_READ_COILS, address, count);
+}
 
-        case MB_FC_WRITE_HOLDING: {
-            uint16_t address = 40000 + bswap16(wordAtOffset(currentPacket.pdu.DATA, 0));
-            uint16_t value = bswap16(wordAtOffset(currentPacket.pdu.DATA, 2));
-            return WriteHolding(address, value);
-            break;
-        }
+static void _discretesChanged(void * context, const uint16_t address, const uint16_t count) {
+    ((SerialModmata *)context)->cache.invalidate(MB_FC_READ_DISCRETES, address, count);
+}
 
-        case MB_FC_WRITE_COILS: {
-            uint16_t startAddress = bswap16(wordAtOffset(currentPacket.pdu.DATA, 0));
-            uint16_t amount = bswap16(wordAtOffset(currentPacket.pdu.DATA, 2));
-            uint8_t * values = currentPacket.pdu.DATA + 5;
-            return WriteCoils(startAddress, amount, values);
-            break;
-        }
+const void SerialModmata::watchForWrites() {
+    inputs.observe(_inputsChanged, this);
+    holdings.observe(_holdingsChanged, this);
+    coils.observe(_coilsChanged, this);
+    discretes.observe(_discretesChanged, this);
+}
 
-        case MB_FC_WRITE_HOLDINGS: {
-            uint16_t startAddress = 40000 + bswap16(wordAtOffset(currentPacket.pdu.DATA, 0));
-            uint16_t amount = bswap16(wordAtOffset(currentPacket.pdu.DATA, 2));
-            uint16_t * values = (uint16_t *)(currentPacket.pdu.DATA + 5);
-            return WriteHoldings(startAddress, amount, values);
-            break;
+const Result SerialModmata::execute() {
+    // The PDU starts at the function code, right after the unit id
+    const uint8_t * pdu = currentPacket.crc_struct + 1;
+    const size_t len = currentPacket.pdu.LEN + 1;
+
+    // A repeated read poll goes out as the frame sent last time
+    if (pdu[0] >= MB_FC_READ_COILS && pdu[0] <= MB_FC_READ_INPUTS) {
+        const unsigned long start = micros();
+        size_t frameLen = 0;
+        const uint8_t * frame = cache.lookup(pdu, len, frameLen);
+
+        if (frame != nullptr) {
+            replyFramed = true;
+            const Result r = response.load(frame, frameLen);
+            telemetry.countRequest(pdu[0], micros() - start, false);
+            return r;
         }
+        replyCacheable = cacheable(pdu, len);
+    }
 
-        case MB_FC_PINMODE: {
-            uint8_t pin = currentPacket.pdu.DATA[0];
-            uint8_t mode = currentPacket.pdu.DATA[1];
-            return PinMode(pin, mode);
-            break;
-        }
+    return ModmataPeripheral::execute(pdu, len);
+}
 
-        case MB_FC_DIGITAL_READ: {
-            uint8_t pin = currentPacket.pdu.DATA[0];
-            return DigitalRead(pin);
-            break;
-        }
+const RX_STATE SerialModmata::rxADU() {
+    // Never waits: pull in whatever has arrived (or just look at what the receive interrupt has put
+    // in) and come back once t3.5 of silence ends the frame
+    const bool framed = rxInterrupt ? receiver.poll(micros()) : receiver.poll(serialStream, micros());
+    if (!framed)                                        return STATE_IDLE;
 
-        case MB_FC_DIGITAL_WRITE: {
-            uint8_t pin = currentPacket.pdu.DATA[0];
-            uint8_t value = currentPacket.pdu.DATA [1];
-            return DigitalWrite(pin, value);
-            break;
-        }
+    const RX_STATE state = checkFrame();
+    telemetry.countFrame(state);
 
-        case MB_FC_ANALOG_READ: {
-            uint8_t pin = currentPacket.pdu.DATA[0];
-            return AnalogRead(pin);
-            break;
-        }
+    // Nothing more to do with a frame that isn't run; the next one can come in right away
+    if (state != STATE_NORMAL && state != STATE_BROADCAST) receiver.release();
+    return state;
+}
 
-        case MB_FC_ANALOG_WRITE: {
-            uint8_t pin = currentPacket.pdu.DATA[0];
-            uint16_t value = wordAtOffset(currentPacket.pdu.DATA, 1);
-            return AnalogWrite(pin, value);
-            break;
-        }
+const RX_STATE SerialModmata::task() {
+    const RX_STATE state = rxADU();
 
-        default: {
-            return makeException(currentPacket.pdu.CODE, MB_EX_ILLEGAL_FUNCTION);
-            break;
-        }
+    if (state == STATE_NORMAL) {
+        execute();
+        txADU();
+    }
+    else if (state == STATE_BADFUNCTION) {
+        // Addressed to us, but not a function we have (the code was copied out of the frame already)
+        makeException(currentPacket.pdu.CODE, MB_EX_ILLEGAL_FUNCTION);
+        txADU();
     }
+    else if (state == STATE_BROADCAST && functionAvailable(currentPacket.pdu.CODE)) execute();
+
+    receiver.release();
+    return state;
 }
 
-const RX_STATE SerialModmata::rxADU() {
-    size_t bytes_waiting = 0;
-    startTimer();
-    while ((!bytes_waiting) && (!timedOut())) {
-        bytes_waiting = serialStream.available();
-    }
+const RX_STATE SerialModmata::checkFrame() {
+    if (receiver.framingError())                        return STATE_RXERROR;
+
+    // The CRC was folded in byte by byte on the way in
+    if (!receiver.crcOk())                              return STATE_BADCRC;
 
-    if (!bytes_waiting)                                 return STATE_TIMEOUT;
-    
-    uint8_t * chunk = (uint8_t *)calloc(bytes_waiting, sizeof(uint8_t));
-    const size_t read_b = serialStream.readBytes(chunk, bytes_waiting);
-    
-    if (read_b != bytes_waiting) { free(chunk);         return STATE_RXERROR; }
-    
-    this->currentPacket = RTU_ADU(chunk, read_b);
-    free(chunk);
+    this->currentPacket = RTU_ADU(receiver.frame(), receiver.frameLength());
+    replyFramed = replyCacheable = false;
 
     // Basic checks
-    if (!currentPacket.checkCRC())                      return STATE_BADCRC;
     if (*currentPacket.address == 0x0)                  return STATE_BROADCAST;
     if (*currentPacket.address != getID())              return STATE_NOTRECIPIENT;
     if (!functionAvailable(currentPacket.pdu.CODE))     return STATE_BADFUNCTION;
     return STATE_NORMAL;
 }
+
+const bool SerialModmata::txADU() {
+    // The reply was built in place by the handler; add our address and the CRC and send the frame as is
+    // (a reply out of the cache has them already)
+    const size_t len = replyFramed ? 1 + response.getPduLen() + 2 : response.finish(getID());
+    if (replyCacheable && !response.result().isException()) cache.store(currentPacket.crc_struct + 1, response.adu(), len);
+    replyFramed = replyCacheable = false;
+
+    if (dePin >= 0) digitalWrite(dePin, HIGH);
+    const size_t sent = serialStream.write(response.adu(), len);
+
+    if (dePin >= 0) {
+        // Stream::flush() on a HardwareSerial returns once the last stop bit is out
+        serialStream.flush();
+        digitalWrite(dePin, LOW);
+    }
+
+    return sent == len;
+}
@@ -6,6 +6,9 @@
 #include <Arduino.h>
 #include <Stream.h>
 #include "Modbus.h"
+#include "rtu.h"
+#include "transport.h"
+#include "cache.h"
 
 #ifndef MODBUSSERIAL_H
 #define MODBUSSERIAL_H
@@ -16,34 +19,18 @@
 #include <SoftwareSerial.h>
 #endif
 
-enum RX_STATE {
-    STATE_RXERROR = 1,
-    STATE_BADCRC = 2,
-    STATE_NOTRECIPIENT = 3,
-    STATE_BADFUNCTION = 4,
-    STATE_TIMEOUT = 5,
-    STATE_BROADCAST = 6,
-    STATE_NORMAL = 7,
-};
-
-typedef struct PDU {
+struct PDU {
     uint8_t     CODE = 0;
     uint8_t *   DATA = nullptr;   // DO NOT calloc/malloc() FOR THIS!
     size_t      LEN  = 0;
 
     PDU() {}
 
-    PDU(const uint8_t func, const uint8_t except) {
-        uint8_t exc_array[1] = {except};   
-        CODE = func + 0x80;
-        DATA = exc_array;
-        LEN = 1u;
-    }
-
     const void use_crc_struct(uint8_t * crc_struct, const size_t len) {
+        // 'len' covers address + function + data (everything the CRC is computed over)
         CODE = crc_struct[1];
         DATA = crc_struct + 2;
-        LEN = len;
+        LEN = len - 2;
     }
 
 };
@@ -51,23 +38,16 @@ typedef struct PDU {
 
 class RTU_ADU {
     /**
-     * i really wish i could define a variable-size struct for this since the
-     * only unknown size is the length of the 'data' segment
-     * 
-     * i.e.
-     *     uint8_t bytearray[] = {0x01, 0x04, 0x02, 0xFF, 0xFF, 0xB8, 0x80};
-     *     ADU frame = bytearray;
-     * 
-     * or something... 
+     * View of a received frame (it points into the RtuReceiver buffer, nothing is copied or allocated)
      * 
      * ADU/Frame format for ModbusRTU: [ https://en.wikipedia.org/wiki/Modbus#Modbus_RTU_frame_format ]
      * Structure of a Modbus RTU packet/message
-     * - (28 bits of 'silence' that we ignore - it's a timed delay in other code, nothing is recv'd)
+     * - (28 bits of 'silence' - this is how RtuReceiver finds the end of the previous frame)
      * - 8-bit (uint8_t) address
      * - 8-bit (uint8_t) function code
      * - N-bytes (uint8_t *) of data
      * - 16-bit (uint16_t) CRC
-     * - (28 bits of 'silence' that we ignore, again)
+     * - (28 bits of 'silence', again)
      */
 
     public:
@@ -80,63 +60,15 @@ class RTU_ADU {
 
         PDU pdu = PDU();
 
-        const size_t allocateGivenDataLen(const size_t len) {
-            // calloc() helper
-            this->len = len;
-            this->crc_struct_len = len - 2;
-            data = (uint8_t *)calloc(len, sizeof(uint8_t));
-            crc_struct = data;
-            address = data;
-            crc = (uint16_t *)(data + (len-2));
-            return len-2;
-        }
-
         RTU_ADU() {}
 
-        RTU_ADU(const uint8_t * d, const size_t len) {
-            // ADU constructor for a 'len' byte long byte-array starting at 'd'
+        RTU_ADU(uint8_t * d, const size_t len) {
+            // ADU view of a 'len' byte long byte-array starting at 'd'
             // 01 04 02 FF FF B8 80
             // 0  1  2  3  4  5  6 ... 7 bytes long
             // +0 +1 +2 +3 +4 +5 +6
-            this->allocateGivenDataLen(len);
-            memcpy(data, d, len);
-            pdu.use_crc_struct(data, len);
-        }
-
-        ~RTU_ADU() {
-            if (data != nullptr) free(data);
-            crc_struct = nullptr;
-            address = nullptr;
-            crc = nullptr;
-
-            len = 0U;
-            crc_struct_len = 0u;
-            pdu = PDU();
-        }
-
-        const RTU_ADU& operator= (const RTU_ADU& assign) {
-            // Assignment constructor
-            // i.e. ADU frame = ADU(&Serial);
-            // where    'assign' == 'ADU(&Serial)'
-            // and      'this' == 'ADU frame'
-
-            if (this != &assign) {
-                this->~RTU_ADU();
-                this->len = assign.len;
-                this->crc_struct_len = assign.crc_struct_len;
-                memcpy(data, assign.data, len);
-
-                this->update();
-            }
-
-            return *this;
-        }
-
-        RTU_ADU(const RTU_ADU& copy) {
-            this->~RTU_ADU();
-            this->len = copy.len;
-            this->crc_struct_len = copy.crc_struct_len;
-            memcpy(data, copy.data, copy.len);
+            this->data = d;
+            this->len = len;
             this->update();
         }
 
@@ -165,31 +97,54 @@ class SerialModmata : public ModmataPeripheral {
         // do we need a tx pin for other boards?
 
         RX_STATE packetState;
+        RtuReceiver receiver;
+        bool rxInterrupt = false;   // 'receiver' is fed from a UartTransport's receive interrupt
+        int16_t dePin = -1;     // RS-485 driver enable for plain Streams (a UartTransport does its own)
+
+        bool replyFramed = false;       // the reply came out of the cache, unit id and CRC included
+        bool replyCacheable = false;    // the reply may go into the cache once it's finished
+
+        const RX_STATE      checkFrame();
+        const void          watchForWrites();
 
     public:
         uint8_t peripheralId;
         RTU_ADU currentPacket;
+        ResponseCache cache;    // finished replies to repeated read polls (see cache.h)
 
         SerialModmata(Stream& stream, unsigned long baud, unsigned int fmt) : serialStream(stream) {
             serialBaudRate = baud;
             serialFormat = fmt;
+            receiver.setBaud(baud);
+            watchForWrites();
         };
 
         const bool          config(Stream& stream, unsigned long baud, unsigned int fmt);
-        const void          setID(const uint8_t ID) { this->peripheralId = ID; }
+        const void          setID(const uint8_t ID) { this->peripheralId = ID; cache.clear(); }
         const uint8_t       getID() const { return peripheralId; }
         const void          setFormat(const unsigned int fmt) { this->serialFormat = fmt; }
         const unsigned int  getFormat() { return serialFormat; }
-        const void          setBaud(const unsigned long baud) { this->serialBaudRate = baud; }
+        const void          setBaud(const unsigned long baud) { this->serialBaudRate = baud; receiver.setBaud(baud); }
         const unsigned long getBaud() { return serialBaudRate; }
         const void          setStream(Stream& stream) { serialStream = stream; }
+        const void          setDriverEnablePin(const int16_t pin);
+
+        // Receive from 'uart's receive interrupt: bytes go straight into the frame receiver, each with
+        // its own timestamp, so the t1.5 gap check is on. 'uart' has to be the Stream this peripheral
+        // was made with (replies still go out through it).
+        const void          useTransport(UartTransport& uart) { uart.attachReceiver(receiver); rxInterrupt = true; }
 
         const void startTimer() {_t = millis();}
         const bool timedOut() {return millis() - _t < serialTimeout;}
 
-        const FunctionStruct& execute();
+        using ModmataPeripheral::execute;
+        const Result        execute();      // the request in 'currentPacket'
         const RX_STATE rxADU();
-        //const bool txADU(const PDU_TYPE t); // (working on this)
+        const bool txADU();
+
+        // Receive, run and answer whatever request has arrived, without waiting for one (a bus
+        // service task for loop() or a Scheduler). Broadcasts are run but not answered.
+        const RX_STATE      task();
 };
 
 #endif // MODBUSSERIAL_H
@@ -0,0 +1,47 @@
+/*
+    ModbusTCP.cpp - Source for Modbus TCP (MBAP) transport
+*/
+
+#include "ModbusTCP.h"
+
+const size_t TcpModmata::serve(const uint8_t * adu, const size_t len) {
+    const uint16_t transaction = makeWord(adu[0], adu[1]);
+    const uint8_t unit = adu[MB_MBAP_HEADER - 1];
+
+    // Unit 0 addresses the server itself over TCP, unless it was asked to act on RTU broadcasts
+    const bool broadcast = (unit == 0 && broadcasts);
+    if (unit != 0 && unit != unitId && unit != MB_TCP_ANY_UNIT && unitId != MB_TCP_ANY_UNIT) {
+        telemetry.countFrame(STATE_NOTRECIPIENT);
+        return 0;
+    }
+
+    // The PDU is the same as over serial, only the framing around it differs
+    execute(adu + MB_MBAP_HEADER, len - MB_MBAP_HEADER);
+
+    if (broadcast) {
+        telemetry.countFrame(STATE_BROADCAST);
+        return 0;
+    }
+
+    telemetry.countFrame(STATE_NORMAL);
+    return response.finishMbap(transaction, unit);
+}
+
+const bool TcpModmata::task(Stream& client, MbapReceiver& rx) {
+    rx.poll(client);
+
+    // Requests are answered in the order they came in, each with its own transaction id
+    const uint8_t * frame;
+    size_t len;
+    while (rx.next(frame, len)) {
+        const size_t n = serve(frame, len);
+        if (n > 0 && client.write(response.mbap(), n) != n) return false;
+    }
+
+    if (rx.framingError()) {
+        telemetry.countFrame(STATE_RXERROR);
+        return false;
+    }
+
+    return true;
+}
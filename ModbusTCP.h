@@ -0,0 +1,126 @@
+/*
+    ModbusTCP.h - Header for Modbus TCP (MBAP) transport
+*/
+
+#include <Arduino.h>
+#include <Stream.h>
+#include "Modbus.h"
+
+#ifndef MODBUSTCP_H
+#define MODBUSTCP_H
+
+#define MB_TCP_PORT         502
+#define MB_TCP_ADU_MAX      (MB_MBAP_HEADER + MB_PDU_MAX)   // 260
+#define MB_TCP_ANY_UNIT     0xFF    // unit id that every TCP peripheral answers to
+
+// Received bytes kept per connection; a controller may send several requests before reading the
+// replies (pipelining), and they queue up here
+#ifndef MB_TCP_RX_BUFFER
+#ifdef ARDUINO
+#define MB_TCP_RX_BUFFER    MB_TCP_ADU_MAX
+#else
+#define MB_TCP_RX_BUFFER    4096
+#endif
+#endif
+
+// Splits a TCP byte stream into MBAP frames
+//
+// [transaction id: 2][protocol id: 2][length: 2][unit id: 1][PDU: length - 1]
+//
+// TCP has no silence between frames, so the length field is the only delimiter. A frame with
+// a protocol id other than 0 or a length outside the PDU limits means the stream is out of step,
+// and the only way back is to drop the connection (framingError()).
+class MbapReceiver {
+    protected:
+        uint8_t buffer[MB_TCP_RX_BUFFER];
+        size_t head = 0;        // start of the first frame not handed out yet
+        size_t tail = 0;        // end of the received data
+        bool broken = false;
+
+        // Move what's left to the front so there's room for a whole frame behind it
+        const void compact() {
+            if (head == 0) return;
+            memmove(buffer, buffer + head, tail - head);
+            tail -= head;
+            head = 0;
+        }
+
+    public:
+        MbapReceiver() {}
+
+        const void reset() { head = tail = 0; broken = false; }
+
+        // Where to receive into, and how much fits (for reading a socket straight into the buffer).
+        // Frames handed out by next() are only valid until this is called.
+        uint8_t * space() { compact(); return buffer + tail; }
+        const size_t room() const { return MB_TCP_RX_BUFFER - tail; }
+        const void commit(const size_t n) { tail += n; }
+
+        // Copy in received bytes; returns how many fitted
+        const size_t feed(const uint8_t * data, const size_t len) {
+            uint8_t * dst = space();
+            const size_t n = len < room() ? len : room();
+            memcpy(dst, data, n);
+            commit(n);
+            return n;
+        }
+
+        // Copy in whatever 'stream' has buffered; returns how many bytes were taken
+        const size_t poll(Stream& stream) {
+            uint8_t * dst = space();
+            size_t n = 0;
+            int c;
+            while (n < room() && stream.available() > 0 && (c = stream.read()) >= 0) dst[n++] = uint8_t(c);
+            commit(n);
+            return n;
+        }
+
+        // Hand out the next complete frame (MBAP header included), if there is one
+        const bool next(const uint8_t *& frame, size_t& len) {
+            if (broken || tail - head < MB_MBAP_HEADER) return false;
+
+            const uint8_t * f = buffer + head;
+            const uint16_t protocol = makeWord(f[2], f[3]);
+            const uint16_t length = makeWord(f[4], f[5]);   // unit id + PDU
+
+            if (protocol != 0 || length < 2 || length > MB_PDU_MAX + 1) { broken = true; return false; }
+            if (tail - head < size_t(MB_MBAP_HEADER - 1) + length) return false;
+
+            frame = f;
+            len = (MB_MBAP_HEADER - 1) + length;
+            head += len;
+            if (head == tail) head = tail = 0;
+            return true;
+        }
+
+        const bool framingError() const { return broken; }
+        const size_t buffered() const { return tail - head; }
+};
+
+class TcpModmata : public ModmataPeripheral {
+    protected:
+        uint8_t unitId = MB_TCP_ANY_UNIT;
+        bool broadcasts = false;
+
+    public:
+        TcpModmata() {}
+
+        // Unit id to answer to besides 0 and MB_TCP_ANY_UNIT (only matters behind a gateway); leave
+        // it at MB_TCP_ANY_UNIT to answer every unit id
+        const void          setID(const uint8_t ID) { this->unitId = ID; }
+        const uint8_t       getID() const { return unitId; }
+
+        // Unit 0 is the server itself over Modbus TCP and gets a reply like any other request. Behind
+        // a gateway that passes RTU broadcasts on, this makes unit 0 requests run without a reply.
+        const void          setBroadcasts(const bool on) { this->broadcasts = on; }
+
+        // Run one MBAP frame from next(); returns the length of the reply at response.mbap(),
+        // or 0 when there's nothing to send back (another unit, or a broadcast)
+        const size_t        serve(const uint8_t * adu, const size_t len);
+
+        // Serve everything 'rx' has for one connection and write the replies to 'client'
+        // (e.g. an EthernetClient). Returns false once the connection has to be closed.
+        const bool          task(Stream& client, MbapReceiver& rx);
+};
+
+#endif // MODBUSTCP_H
@@ -0,0 +1,385 @@
+/*
+    bench_execute.cpp - Throughput and latency of every supported function code
+
+    Each request goes through the whole path a real frame takes: RtuReceiver (bytes + per-byte CRC),
+    end of frame on t3.5 silence, rxADU() checks, execute() dispatch, the handler, and txADU()
+    finishing the reply (unit id + CRC) and writing it out. Register tables of several sizes and
+    requests of several widths are swept. After that, the Read Compressed coder is run on its own over
+    a few typical block shapes, for the compression ratio and the cost of coding.
+
+    Usage: modmata-bench [iterations-per-case]
+*/
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../ModbusSerial.h"
+#include "../host/RegisterDecoder.h"
+
+// Heap accounting: the whole process allocates through these, so a request's allocations are the
+// difference in the counter across it
+extern "C" void * __libc_malloc(size_t size);
+extern "C" void * __libc_calloc(size_t n, size_t size);
+extern "C" void * __libc_realloc(void * ptr, size_t size);
+
+static unsigned long heapAllocations = 0;
+
+extern "C" void * malloc(size_t size) { heapAllocations++; return __libc_malloc(size); }
+extern "C" void * calloc(size_t n, size_t size) { heapAllocations++; return __libc_calloc(n, size); }
+extern "C" void * realloc(void * ptr, size_t size) { heapAllocations++; return __libc_realloc(ptr, size); }
+
+#define BENCH_UNIT_ID       0x11
+#define BENCH_BAUD          115200ul
+#define BENCH_SILENCE_US    (MB_RTU_FIXED_T35_US + 1)
+#define BENCH_I2C_DEVICE    0x40
+
+// In-memory serial line: the request to receive, and a byte counter for the reply
+class BenchLine : public Stream {
+    protected:
+        uint8_t rx[MB_ADU_MAX];
+        size_t rxLen = 0;
+        size_t rxPos = 0;
+
+    public:
+        size_t txBytes = 0;
+
+        const void load(const uint8_t * frame, const size_t len) {
+            memcpy(rx, frame, len);
+            rxLen = len;
+            rxPos = 0;
+            txBytes = 0;
+        }
+
+        int available() override { return int(rxLen - rxPos); }
+        int read() override { return rxPos < rxLen ? rx[rxPos++] : -1; }
+        int peek() override { return rxPos < rxLen ? rx[rxPos] : -1; }
+        size_t write(uint8_t b) override { (void)b; txBytes++; return 1; }
+        size_t write(const uint8_t * buffer, size_t size) override { (void)buffer; txBytes += size; return size; }
+        using Print::write;
+};
+
+struct BenchCase {
+    uint8_t code;
+    const char * name;
+    uint16_t width;         // registers/bits per request, sub-requests per batch (0 for the pin functions)
+    bool cached = false;    // repeats answered from the response cache (otherwise it's emptied first)
+    uint8_t last = 0;       // batches: function of the last sub-request, if not part of the scan
+};
+
+static const BenchCase cases[] = {
+    {MB_FC_READ_COILS,      "read coils",       8},
+    {MB_FC_READ_COILS,      "read coils",       256},
+    {MB_FC_READ_COILS,      "read coils",       2000},
+    {MB_FC_READ_DISCRETES,  "read discretes",   8},
+    {MB_FC_READ_DISCRETES,  "read discretes",   2000},
+    {MB_FC_READ_HOLDINGS,   "read holdings",    1},
+    {MB_FC_READ_HOLDINGS,   "read holdings",    16},
+    {MB_FC_READ_HOLDINGS,   "read holdings",    125},
+    {MB_FC_READ_INPUTS,     "read inputs",      1},
+    {MB_FC_READ_INPUTS,     "read inputs",      125},
+    {MB_FC_READ_COILS,      "cached coils",     2000,   true},
+    {MB_FC_READ_HOLDINGS,   "cached holdings",  16,     true},
+    {MB_FC_READ_HOLDINGS,   "cached holdings",  125,    true},
+    {MB_FC_READ_FIFO,       "read fifo",        MB_FIFO_MAX},
+    {MB_FC_READ_CHANGES,    "read changes",     61},
+    {MB_FC_READ_COMPRESSED, "read compressed",  125},
+    {MB_FC_WRITE_COIL,      "write coil",       1},
+    {MB_FC_WRITE_HOLDING,   "write holding",    1},
+    {MB_FC_WRITE_COILS,     "write coils",      8},
+    {MB_FC_WRITE_COILS,     "write coils",      1968},
+    {MB_FC_WRITE_HOLDINGS,  "write holdings",   1},
+    {MB_FC_WRITE_HOLDINGS,  "write holdings",   16},
+    {MB_FC_WRITE_HOLDINGS,  "write holdings",   123},
+    {MB_FC_MASK_WRITE_HOLDING,  "mask write",   1},
+    {MB_FC_READ_WRITE_HOLDINGS, "read/write",   16},
+    {MB_FC_READ_WRITE_HOLDINGS, "read/write",   121},
+    {MB_FC_BATCH,           "batch",            4},
+    {MB_FC_BATCH,           "batch",            16},
+    {MB_FC_BATCH,           "batch+i2c read",   36,     false,  MB_FC_WIRE_READ},  // just fits
+    {MB_FC_BATCH,           "batch+i2c read",   41,     false,  MB_FC_WIRE_READ},  // stops before it
+    {MB_FC_PINMODE,         "pinMode",          0},
+    {MB_FC_DIGITAL_READ,    "digitalRead",      0},
+    {MB_FC_DIGITAL_WRITE,   "digitalWrite",     0},
+    {MB_FC_ANALOG_READ,     "analogRead",       0},
+    {MB_FC_ANALOG_WRITE,    "analogWrite",      0},
+    {MB_FC_PORT_READ,       "port read",        8},
+    {MB_FC_PORT_WRITE,      "port write",       8},
+    {MB_FC_WIRE_READ,       "i2c read",         6},
+    {MB_FC_WIRE_TRANSACTIONS, "i2c txns",         4},
+    {MB_FC_SPI_TRANSFER,    "spi transfer",     16},
+    {MB_FC_SPI_TRANSFER,    "spi transfer",     252},
+};
+
+static const uint16_t tableSizes[] = {16, 256, 2000};
+
+static uint64_t nowNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+static int compareNanos(const void * a, const void * b) {
+    const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Build the RTU frame for 'c' into 'frame'; returns its length
+static size_t buildRequest(const BenchCase& c, uint8_t * frame) {
+    uint8_t * p = frame;
+    *p++ = BENCH_UNIT_ID;
+    *p++ = c.code;
+
+    switch (c.code) {
+        case MB_FC_READ_COILS: case MB_FC_READ_DISCRETES:
+        case MB_FC_READ_HOLDINGS: case MB_FC_READ_INPUTS:
+            *p++ = 0; *p++ = 0;
+            *p++ = highByte(c.width); *p++ = lowByte(c.width);
+            break;
+
+        case MB_FC_READ_FIFO:
+            *p++ = highByte(MB_SAMPLER_BASE); *p++ = lowByte(MB_SAMPLER_BASE);
+            break;
+
+        case MB_FC_READ_CHANGES:
+            // Everything changed since provisioning: a full page of (address, value) pairs
+            *p++ = MB_REGISTER_HOLDING; *p++ = 0; *p++ = 0; *p++ = 0; *p++ = 0; *p++ = 0; *p++ = 0;
+            break;
+
+        case MB_FC_READ_COMPRESSED:
+            *p++ = MB_REGISTER_HOLDING; *p++ = 0; *p++ = 0;
+            *p++ = highByte(c.width); *p++ = lowByte(c.width);
+            break;
+
+        case MB_FC_WRITE_COIL:
+            *p++ = 0; *p++ = 3; *p++ = 0xFF; *p++ = 0x00;
+            break;
+
+        case MB_FC_WRITE_HOLDING:
+            *p++ = 0; *p++ = 3; *p++ = 0x12; *p++ = 0x34;
+            break;
+
+        case MB_FC_WRITE_COILS: {
+            const uint8_t bytes = (c.width + 7) / 8;
+            *p++ = 0; *p++ = 0;
+            *p++ = highByte(c.width); *p++ = lowByte(c.width);
+            *p++ = bytes;
+            for (uint8_t i = 0; i < bytes; i++) *p++ = 0xA5 ^ i;
+            break;
+        }
+
+        case MB_FC_WRITE_HOLDINGS:
+            *p++ = 0; *p++ = 0;
+            *p++ = highByte(c.width); *p++ = lowByte(c.width);
+            *p++ = c.width * 2;
+            for (uint16_t i = 0; i < c.width; i++) { *p++ = highByte(i); *p++ = lowByte(i); }
+            break;
+
+        case MB_FC_MASK_WRITE_HOLDING:
+            *p++ = 0; *p++ = 3; *p++ = 0x00; *p++ = 0xF2; *p++ = 0x00; *p++ = 0x25;
+            break;
+
+        case MB_FC_READ_WRITE_HOLDINGS:
+            // Write 'width' registers at 0, read them back
+            *p++ = 0; *p++ = 0; *p++ = highByte(c.width); *p++ = lowByte(c.width);
+            *p++ = 0; *p++ = 0; *p++ = highByte(c.width); *p++ = lowByte(c.width);
+            *p++ = c.width * 2;
+            for (uint16_t i = 0; i < c.width; i++) { *p++ = highByte(i); *p++ = lowByte(i); }
+            break;
+
+        case MB_FC_BATCH:
+            // An I/O scan: three quarters digitalWrite, the rest analogRead
+            *p++ = c.width;
+            if (c.last == MB_FC_WIRE_READ) {
+                // Pin reads, then an I2C read of a whole Wire buffer where the frame runs out
+                for (uint16_t i = 0; i + 1 < c.width; i++) { *p++ = 2; *p++ = MB_FC_DIGITAL_READ; *p++ = i % 14; }
+                *p++ = 3; *p++ = MB_FC_WIRE_READ; *p++ = BENCH_I2C_DEVICE; *p++ = MB_WIRE_BUFFER;
+                break;
+            }
+            for (uint16_t i = 0; i < c.width; i++) {
+                if (i < c.width * 3 / 4)    { *p++ = 3; *p++ = MB_FC_DIGITAL_WRITE; *p++ = i % 14; *p++ = i & 1; }
+                else                        { *p++ = 2; *p++ = MB_FC_ANALOG_READ; *p++ = i % 6; }
+            }
+            break;
+
+        case MB_FC_WIRE_READ:
+            *p++ = BENCH_I2C_DEVICE; *p++ = c.width;
+            break;
+
+        case MB_FC_WIRE_TRANSACTIONS:
+            // A sensor poll: set the register pointer, read 6 bytes back, 'width' times
+            *p++ = c.width;
+            for (uint16_t i = 0; i < c.width; i++) { *p++ = BENCH_I2C_DEVICE; *p++ = 1; *p++ = i * 8; *p++ = 6; }
+            break;
+
+        case MB_FC_SPI_TRANSFER:
+            for (uint16_t i = 0; i < c.width; i++) *p++ = i;
+            break;
+
+        case MB_FC_PINMODE:         *p++ = 13; *p++ = OUTPUT;   break;
+        case MB_FC_DIGITAL_READ:    *p++ = 13;                  break;
+        case MB_FC_DIGITAL_WRITE:   *p++ = 13; *p++ = HIGH;     break;
+        case MB_FC_ANALOG_READ:     *p++ = 3;                   break;
+        case MB_FC_ANALOG_WRITE:    *p++ = 9; *p++ = 0; *p++ = 128; break;
+        case MB_FC_PORT_READ:       *p++ = 2;                   break;
+        case MB_FC_PORT_WRITE:      *p++ = 2; *p++ = 0; *p++ = 0xFF; *p++ = 0; *p++ = 0xA5; break;
+    }
+
+    const uint16_t crc = crc16(frame, p - frame);
+    *p++ = lowByte(crc);
+    *p++ = highByte(crc);
+    return p - frame;
+}
+
+// Whether the slots of a Batch reply add up to its length, as they don't after a sub-reply overran it
+static bool batchIntact(const Result& r) {
+    if (r.isException()) return true;
+
+    size_t pos = 2;
+    for (uint8_t i = 0; i < r.DATA[1]; i++) {
+        if (pos >= r.LEN) return false;
+        pos += 1 + r.DATA[pos];
+    }
+    return pos == r.LEN && r.LEN <= MB_PDU_MAX;
+}
+
+static void provision(SerialModmata& sm, const uint16_t registers) {
+    // Every space gets 'registers' entries starting at its first address
+    sm.holdings.reserve(registers);
+    sm.inputs.reserve(registers);
+    for (uint16_t i = 0; i < registers; i++) {
+        sm.holdings.addRegister(i, i);
+        sm.inputs.addRegister(i, i);
+    }
+
+    sm.coils.reserve(registers);
+    sm.discretes.reserve(registers);
+    for (uint16_t i = 0; i < registers; i++) {
+        sm.coils.set(i, i & 1);
+        sm.discretes.set(i, i & 2);
+    }
+}
+
+// Register blocks of the kinds the coder is meant for, and one it can't help with
+static uint16_t blockWord(const uint8_t shape, const uint16_t i) {
+    switch (shape) {
+        case 0:  return i % 16 == 0 ? 0x0100 + i : 0;                  // sparse configuration
+        case 1:  return i < 40 ? 0x00FF : 0x8000;                       // repeated settings
+        case 2:  return 2048 + int(i % 7) - 3;                          // slowly moving measurements
+        default: return uint16_t((i * 40503u) ^ (i << 7));              // noise
+    }
+}
+static const char * const blockShapes[] = {"sparse", "repeats", "drift", "noise"};
+
+// Coded size and coding time of a 125 register block of each shape; every block is decoded again
+// to check the round trip
+static void benchCompression(const unsigned long iterations, uint64_t * samples) {
+    printf("\n%-10s  %5s  %5s  %6s  %8s  %8s  %11s\n",
+           "block", "raw", "coded", "ratio", "p50 ns", "p99 ns", "ns/register");
+
+    for (uint8_t shape = 0; shape < 4; shape++) {
+        uint8_t raw[2 * 125];
+        uint8_t coded[2 * 125 + 1];
+        for (uint16_t i = 0; i < 125; i++) { raw[2*i] = highByte(blockWord(shape, i)); raw[2*i + 1] = lowByte(blockWord(shape, i)); }
+
+        size_t len = 0;
+        for (unsigned long i = 0; i < iterations; i++) {
+            const uint64_t t0 = nowNanos();
+            len = compressRegisters(coded, raw, 125);
+            samples[i] = nowNanos() - t0;
+        }
+        qsort(samples, iterations, sizeof(uint64_t), compareNanos);
+
+        uint16_t decoded[125];
+        bool ok = decodeRegisters(coded, len, decoded, 125) == 125;
+        for (uint16_t i = 0; i < 125 && ok; i++) ok = decoded[i] == blockWord(shape, i);
+
+        printf("%-10s  %5u  %5zu  %5.2fx  %8llu  %8llu  %11.1f  %s\n",
+               blockShapes[shape], 250u, len, 250.0 / len,
+               (unsigned long long)samples[iterations / 2],
+               (unsigned long long)samples[(iterations * 99) / 100],
+               samples[iterations / 2] / 125.0,
+               ok ? "" : "FAIL");
+    }
+}
+
+int main(int argc, char ** argv) {
+    const unsigned long iterations = argc > 1 ? strtoul(argv[1], nullptr, 10) : 20000ul;
+    uint64_t * samples = (uint64_t *)__libc_malloc(sizeof(uint64_t) * iterations);
+
+    printf("%-4s  %-15s  %5s  %5s  %12s  %8s  %8s  %10s  %4s\n",
+           "fc", "function", "regs", "width", "frames/s", "p50 ns", "p99 ns", "allocs/req", "exc");
+
+    for (const uint16_t registers : tableSizes) {
+        BenchLine line;
+        SerialModmata sm(line, BENCH_BAUD, SERIAL_8N1);
+        sm.setID(BENCH_UNIT_ID);
+        provision(sm, registers);
+
+        // One analog channel behind the FIFO reads, topped up before each one
+        AnalogSampler sampler;
+        const uint8_t samplerPin = 0;
+        sampler.begin(&samplerPin, 1, 1);
+        sm.attach(sampler);
+
+        // A 64 byte register-file device on the simulated I2C bus
+        static uint8_t i2cMemory[64];
+        Wire.hostDevice(BENCH_I2C_DEVICE, i2cMemory, sizeof(i2cMemory));
+        sm.WireBeginController();
+        sm.SpiBegin();      // loopback
+
+        for (const BenchCase& c : cases) {
+            uint8_t frame[MB_ADU_MAX];
+            const size_t len = buildRequest(c, frame);
+            unsigned long allocations = 0;
+            unsigned long exceptions = 0;
+            unsigned long failures = 0;
+
+            for (unsigned long i = 0; i < iterations + iterations / 10; i++) {
+                const bool warmup = i < iterations / 10;
+                line.load(frame, len);
+                if (!c.cached) sm.cache.clear();
+                while (sampler.buffered(0) < c.width && c.code == MB_FC_READ_FIFO) {
+                    hostAdvanceMicros(1);
+                    sampler.poll(micros());
+                }
+
+                const unsigned long heapBefore = heapAllocations;
+                const uint64_t t0 = nowNanos();
+
+                RX_STATE state = sm.rxADU();            // drains the line, frame still open
+                hostAdvanceMicros(BENCH_SILENCE_US);    // the line goes quiet for t3.5
+                state = sm.rxADU();
+
+                if (state == STATE_NORMAL) {
+                    sm.execute();
+                    sm.txADU();
+                }
+
+                const uint64_t t1 = nowNanos();
+                if (warmup) continue;
+
+                samples[i - iterations / 10] = t1 - t0;
+                allocations += heapAllocations - heapBefore;
+                if (state != STATE_NORMAL || line.txBytes == 0) failures++;
+                else if (c.code == MB_FC_BATCH && !batchIntact(sm.response.result())) failures++;
+                else if (sm.response.result().isException()) exceptions++;
+            }
+
+            uint64_t total = 0;
+            for (unsigned long i = 0; i < iterations; i++) total += samples[i];
+            qsort(samples, iterations, sizeof(uint64_t), compareNanos);
+
+            printf("0x%02X  %-15s  %5u  %5u  %12.0f  %8llu  %8llu  %10.2f  %4s\n",
+                   c.code, c.name, registers, c.width,
+                   iterations / (total / 1e9),
+                   (unsigned long long)samples[iterations / 2],
+                   (unsigned long long)samples[(iterations * 99) / 100],
+                   double(allocations) / iterations,
+                   failures ? "FAIL" : exceptions ? "yes" : "");
+        }
+    }
+
+    benchCompression(iterations, samples);
+    return 0;
+}
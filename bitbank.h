@@ -0,0 +1,199 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "registers.h"
+
+#ifndef BITBANK_H
+#define BITBANK_H
+
+// Modbus request limits for 1-bit spaces (Modbus Application Protocol v1.1b, 6.1/6.2/6.11)
+#define MB_MAX_READ_BITS    2000
+#define MB_MAX_WRITE_BITS   1968
+
+// Container type for 1-bit Modbus spaces (coils 0xxxx, discretes 1xxxx)
+// Bit n of the bank is bit (n % 8) of byte (n / 8), which is exactly the order Modbus packs
+// coils into a PDU, so reads and writes are shift/mask copies instead of per-coil lookups.
+// One bit per coil instead of a 4 byte Register holding 0xFF00/0x0000 is 32x less RAM.
+class BitBank {
+    protected:
+        uint8_t * bits = nullptr;
+        uint16_t bitCount = 0;      // highest addressable bit + 1
+        uint16_t byteCapacity = 0;
+        bool ownsStorage = true;    // false once useStorage() points the bank at static storage
+        RegisterBinding * bindings = nullptr;   // bits resolved through callbacks, see bind()
+        WriteObserver observer = nullptr;       // told about changed bits, see observe()
+        void * observerContext = nullptr;
+
+        const void notify(const uint16_t address, const uint16_t count = 1) const {
+            if (observer != nullptr) observer(observerContext, address, count);
+        }
+
+        const uint8_t byteAt(const uint16_t index) const {
+            // Bits past the end of storage read as 0
+            return index < byteCapacity ? bits[index] : 0u;
+        }
+
+    public:
+        BitBank() {}
+        ~BitBank() { if (ownsStorage) free(bits); bits = nullptr; bitCount = byteCapacity = 0; }
+
+        const BitBank& operator= (const BitBank& assign) {
+            if (this != &assign) {
+                this->~BitBank();
+                ownsStorage = true;
+                bindings = assign.bindings;
+                if (reserve(assign.bitCount)) {
+                    memcpy(bits, assign.bits, (assign.bitCount + 7u) / 8u);
+                    bitCount = assign.bitCount;
+                }
+                notify(0, 0xFFFF);
+            }
+
+            return *this;
+        }
+
+        BitBank(const BitBank& copy) { *this = copy; }
+
+        // Make room for 'count' bits in a single allocation (new bits start cleared)
+        const bool reserve(const uint16_t count) {
+            if (!ownsStorage) return count <= bitCount;     // fixed-size static storage can't grow
+            const uint16_t bytes = (uint32_t(count) + 7u) / 8u;
+            if (bytes <= byteCapacity) return true;
+
+            uint8_t * grown = (uint8_t *)realloc(bits, bytes);
+            if (grown == NULL) return false;
+
+            memset(grown + byteCapacity, 0u, bytes - byteCapacity);
+            bits = grown;
+            byteCapacity = bytes;
+            return true;
+        }
+
+        // Serve the bank from caller-provided storage of 'count' bits (e.g. a StaticBitMap, see regmap.h)
+        // instead of the heap; the bank is then fixed at that size
+        const void useStorage(uint8_t * storage, const uint16_t count) {
+            this->~BitBank();
+            ownsStorage = false;
+            bits = storage;
+            bitCount = count;
+            byteCapacity = (uint32_t(count) + 7u) / 8u;
+            notify(0, count);
+        }
+
+        const uint16_t size() const { return bitCount; }
+
+        // Resolve 'binding's bits through its callbacks from now on (any nonzero read is a 1); the
+        // bank's own storage for them is left alone
+        const void bind(RegisterBinding& binding) {
+            binding.next = bindings;
+            bindings = &binding;
+            notify(binding.first, binding.count);
+        }
+
+        // Whether any of the 'count' bits from 'address' is bound (read through a callback)
+        const bool bound(const uint16_t address, const uint16_t count) const { return _rangeBound(bindings, address, count); }
+
+        // Call 'observer(context, address, count)' whenever bits change through the bank (writes,
+        // new storage or bindings). Code that writes the storage directly calls touch() instead.
+        const void observe(WriteObserver observer, void * context) {
+            this->observer = observer;
+            this->observerContext = context;
+        }
+
+        const void touch(const uint16_t address, const uint16_t count = 1) const { notify(address, count); }
+
+        const bool get(const uint16_t address) const {
+            const RegisterBinding * bound = _bindingFor(bindings, address);
+            if (bound != nullptr) return bound->get(address) != 0;
+
+            return bitRead(byteAt(address >> 3), address & 7);
+        }
+
+        const bool set(const uint16_t address, const bool value) {
+            const RegisterBinding * bound = _bindingFor(bindings, address);
+            if (bound != nullptr) return bound->put(address, value);
+
+            // Like RegisterArray::setRegister, writing past the end grows the bank
+            if (address >= bitCount) {
+                if (!reserve(address + 1u)) return false;
+                bitCount = address + 1u;
+            }
+
+            const uint8_t mask = 1u << (address & 7);
+            if (bool(bits[address >> 3] & mask) == value) return true;
+            if (value)  bits[address >> 3] |= mask;
+            else        bits[address >> 3] &= ~mask;
+            notify(address);
+            return true;
+        }
+
+        // Pack 'count' bits starting at 'address' into 'out', LSB first, padding the last byte with 0s
+        const void readBits(const uint16_t address, const uint16_t count, uint8_t * out) const {
+            const uint16_t q = address >> 3;
+            const uint8_t s = address & 7;
+            const uint16_t n = (uint32_t(count) + 7u) / 8u;
+
+            for (uint16_t i = 0; i < n; i++) {
+                const uint16_t w = makeWord(byteAt(q + i + 1), byteAt(q + i));
+                out[i] = lowByte(w >> s);
+            }
+
+            if (count & 7) out[n-1] &= (1u << (count & 7)) - 1u;
+
+            // Bound bits replace whatever the copy put there
+            for (const RegisterBinding * b = bindings; b != nullptr; b = b->next) {
+                const uint32_t from = b->first > address ? b->first : address;
+                const uint32_t to = uint32_t(b->first) + b->count < uint32_t(address) + count
+                                  ? uint32_t(b->first) + b->count : uint32_t(address) + count;
+                for (uint32_t a = from; a < to; a++) {
+                    const uint16_t i = a - address;
+                    if (b->get(a)) out[i >> 3] |= 1u << (i & 7);
+                    else           out[i >> 3] &= ~(1u << (i & 7));
+                }
+            }
+        }
+
+        // Apply 'count' packed bits from 'in' starting at 'address'; false if the bank couldn't grow
+        // or a binding refused its bit
+        const bool writeBits(const uint16_t address, const uint16_t count, const uint8_t * in) {
+            const uint32_t top = uint32_t(address) + count;
+            if (top > 0xFFFFu) return false;
+
+            // A range with bound bits in it goes bit by bit; the rest is a shifted byte copy
+            if (_runBeforeBinding(bindings, address) < count || _bindingFor(bindings, address) != nullptr) {
+                for (uint16_t i = 0; i < count; i++)
+                    if (!set(address + i, bitRead(in[i >> 3], i & 7))) return false;
+                return true;
+            }
+            if (top > bitCount) {
+                if (!reserve(top)) return false;
+                bitCount = top;
+            }
+
+            const uint16_t q = address >> 3;
+            const uint8_t s = address & 7;
+            const uint16_t n = (uint32_t(count) + 7u) / 8u;
+
+            for (uint16_t i = 0; i < n; i++) {
+                const uint8_t valid = (i == n-1 && (count & 7)) ? (1u << (count & 7)) - 1u : 0xFFu;
+                const uint16_t m = uint16_t(valid) << s;
+                const uint16_t v = uint16_t(in[i] & valid) << s;
+
+                bits[q+i] = (bits[q+i] & ~lowByte(m)) | lowByte(v);
+                if (highByte(m)) bits[q+i+1] = (bits[q+i+1] & ~highByte(m)) | highByte(v);
+            }
+
+            notify(address, count);
+            return true;
+        }
+
+        const void printBits() const {
+            for (uint16_t i = 0; i < bitCount; i++) {
+                if (!get(i)) continue;
+                Serial.print("Bit: ");
+                Serial.println(i);
+            }
+        }
+};
+
+#endif // BITBANK_H
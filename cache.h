@@ -0,0 +1,113 @@
+#include <Arduino.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "frame.h"
+
+#ifndef MODBUS_CACHE_H
+#define MODBUS_CACHE_H
+
+// Replies to repeated read polls, kept ready to send
+//
+// Controllers tend to send the same Read Coils/Discretes/Holdings/Inputs request over and over
+// between changes. A ResponseCache keeps the finished reply frames (unit id and CRC included) of
+// the last few, keyed on the request PDU, so a repeat is answered by copying the frame out instead
+// of running the handler and the CRC again.
+//
+// Entries are dropped as soon as anything they cover may have changed: the register table and bit
+// banks report every change to invalidate() (see observe() in registers.h/bitbank.h). Whatever
+// isn't stored, and so can change without a write (bound ranges, the telemetry and sampler blocks),
+// is never cached in the first place; ModmataPeripheral::cacheable() decides that.
+
+#ifndef MB_CACHE_ENTRIES
+#ifdef ARDUINO
+#define MB_CACHE_ENTRIES        2
+#else
+#define MB_CACHE_ENTRIES        8
+#endif
+#endif
+
+#ifndef MB_CACHE_FRAME
+#ifdef ARDUINO
+#define MB_CACHE_FRAME          64      // a 29 register / 480 coil reply; longer ones aren't cached
+#else
+#define MB_CACHE_FRAME          MB_ADU_MAX
+#endif
+#endif
+
+#define MB_CACHE_KEY            5       // [function code][address][count]
+
+struct CacheEntry {
+    uint8_t     request[MB_CACHE_KEY];
+    uint16_t    len;                    // of 'frame', 0 for a free entry
+    uint16_t    lastUse;
+    uint8_t     frame[MB_CACHE_FRAME];
+};
+
+class ResponseCache {
+    protected:
+        CacheEntry  entries[MB_CACHE_ENTRIES];
+        uint16_t    clock = 0;
+
+        // Entry that is free, or else the least recently used one
+        CacheEntry& victim() {
+            CacheEntry * v = entries;
+            for (uint8_t i = 0; i < MB_CACHE_ENTRIES; i++) {
+                if (entries[i].len == 0) return entries[i];
+                if (uint16_t(clock - entries[i].lastUse) > uint16_t(clock - v->lastUse)) v = entries + i;
+            }
+            return *v;
+        }
+
+    public:
+        uint32_t    hits = 0;
+        uint32_t    misses = 0;
+
+        ResponseCache() { clear(); }
+
+        const void clear() { for (uint8_t i = 0; i < MB_CACHE_ENTRIES; i++) entries[i].len = 0; }
+
+        // The cached reply frame for the request 'pdu', or nullptr; 'len' gets its length
+        const uint8_t * lookup(const uint8_t * pdu, const size_t pduLen, size_t& len) {
+            if (pduLen == MB_CACHE_KEY) {
+                for (uint8_t i = 0; i < MB_CACHE_ENTRIES; i++) {
+                    CacheEntry& e = entries[i];
+                    if (e.len == 0 || memcmp(e.request, pdu, MB_CACHE_KEY) != 0) continue;
+
+                    e.lastUse = ++clock;
+                    hits++;
+                    len = e.len;
+                    return e.frame;
+                }
+            }
+
+            misses++;
+            return nullptr;
+        }
+
+        // Keep the reply 'frame' to the request 'pdu' (a read request, see cacheable())
+        const void store(const uint8_t * pdu, const uint8_t * frame, const size_t len) {
+            if (len > MB_CACHE_FRAME) return;
+
+            CacheEntry& e = victim();
+            memcpy(e.request, pdu, MB_CACHE_KEY);
+            memcpy(e.frame, frame, len);
+            e.len = len;
+            e.lastUse = ++clock;
+        }
+
+        // Drop every reply of read function 'code' (so its space) that covers any of the 'count'
+        // addresses from protocol address 'address'
+        const void invalidate(const uint8_t code, const uint16_t address, const uint16_t count) {
+            for (uint8_t i = 0; i < MB_CACHE_ENTRIES; i++) {
+                CacheEntry& e = entries[i];
+                if (e.len == 0 || e.request[0] != code) continue;
+
+                const uint32_t first = makeWord(e.request[1], e.request[2]);
+                const uint32_t last = first + makeWord(e.request[3], e.request[4]);
+                if (first < uint32_t(address) + count && address < last) e.len = 0;
+            }
+        }
+};
+
+#endif // MODBUS_CACHE_H
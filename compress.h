@@ -0,0 +1,127 @@
+#include <Arduino.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef MODBUS_COMPRESS_H
+#define MODBUS_COMPRESS_H
+
+// Run-length/delta coding of register blocks, for Read Compressed (0x6E)
+//
+// A block of 16-bit registers is coded as a sequence of tokens, each a header byte that says what
+// follows and how many registers it stands for:
+//
+//   0nnnnnnn   literal     n+1 registers (1..128) follow as big-endian words
+//   10nnnnnn   zeros       n+1 registers (1..64) that are 0, nothing follows
+//   110nnnnn   repeat      n+3 registers (3..34) that all hold the word that follows
+//   111nnnnn   delta       n+3 registers (3..34), one signed byte each follows: the difference
+//                          from the register before it (from 0 for the block's first register)
+//
+// The encoder only leaves a literal for another token when that saves at least two bytes, so a
+// block never codes to more than one byte over its raw size (a single literal), and it can run in
+// place: 'out' may overlap 'in' as long as it starts at least 2 bytes before it. That lets the
+// reply be coded over the raw register read it came from, without a second buffer.
+//
+// The controller side decoder is host/RegisterDecoder.h.
+
+#define MB_RLE_LITERAL      0x00
+#define MB_RLE_ZEROS        0x80
+#define MB_RLE_REPEAT       0xC0
+#define MB_RLE_DELTA        0xE0
+
+#define MB_RLE_LITERAL_MAX  128
+#define MB_RLE_ZEROS_MAX    64
+#define MB_RLE_RUN_MIN      3       // repeat and delta tokens
+#define MB_RLE_RUN_MAX      34
+
+// Registers from 'i' on (at most 'limit') that equal register 'i'
+static inline const uint16_t _rleSame(const uint8_t * in, const uint16_t i, const uint16_t count, const uint16_t limit) {
+    uint16_t n = 1;
+    while (n < limit && i + n < count && in[2*(i+n)] == in[2*i] && in[2*(i+n) + 1] == in[2*i + 1]) n++;
+    return n;
+}
+
+// Registers from 'i' on (at most MB_RLE_RUN_MAX) that are each within a signed byte of the one before,
+// stopping short of any run of MB_RLE_RUN_MIN equal registers (better coded as zeros or a repeat)
+static inline const uint16_t _rleDeltas(const uint8_t * in, const uint16_t i, const uint16_t count, uint16_t prev) {
+    uint16_t n = 0;
+    while (n < MB_RLE_RUN_MAX && i + n < count) {
+        const uint16_t w = makeWord(in[2*(i+n)], in[2*(i+n) + 1]);
+        const int16_t d = int16_t(w - prev);
+        if (d < -128 || d > 127) break;
+        if (n > 0 && _rleSame(in, i + n, count, MB_RLE_RUN_MIN) == MB_RLE_RUN_MIN) break;
+        prev = w;
+        n++;
+    }
+    return n;
+}
+
+// Code 'count' registers (big-endian words at 'in') to 'out'; returns the coded length, which is at
+// most 2 * count + 1. 'count' is limited to MB_RLE_LITERAL_MAX, the most one literal token covers.
+static inline const size_t compressRegisters(uint8_t * out, const uint8_t * in, const uint16_t count) {
+    size_t o = 0;
+    uint16_t i = 0;
+    uint16_t prev = 0;
+    size_t literal = 0;         // header position of the open literal token
+    uint8_t literals = 0;       // registers in it, 0 when there isn't one
+
+    while (i < count) {
+        const uint16_t w = makeWord(in[2*i], in[2*i + 1]);
+        const uint16_t zeros = w == 0 ? _rleSame(in, i, count, MB_RLE_ZEROS_MAX) : 0;
+        const uint16_t repeats = _rleSame(in, i, count, MB_RLE_RUN_MAX);
+        const uint16_t deltas = _rleDeltas(in, i, count, prev);
+
+        // Bytes each token saves over coding the same registers as literals
+        const int zeroSaving = zeros >= 2 ? 2 * zeros - 1 : 0;
+        const int repeatSaving = repeats >= MB_RLE_RUN_MIN ? 2 * repeats - 3 : 0;
+        const int deltaSaving = deltas >= MB_RLE_RUN_MIN ? deltas - 1 : 0;
+        const int best = zeroSaving > repeatSaving ? (zeroSaving > deltaSaving ? zeroSaving : deltaSaving)
+                                                   : (repeatSaving > deltaSaving ? repeatSaving : deltaSaving);
+
+        if (best < 2) {
+            // Payload before header throughout: with 'out' behind 'in' every byte written has been read
+            if (literals == 0 || literals == MB_RLE_LITERAL_MAX) {
+                if (literals != 0) out[literal] = MB_RLE_LITERAL | (literals - 1);
+                literal = o++;
+                literals = 0;
+            }
+            out[o++] = in[2*i];
+            out[o++] = in[2*i + 1];
+            literals++;
+            prev = w;
+            i++;
+            continue;
+        }
+
+        if (literals != 0) { out[literal] = MB_RLE_LITERAL | (literals - 1); literals = 0; }
+
+        if (best == zeroSaving) {
+            out[o++] = MB_RLE_ZEROS | (zeros - 1);
+            prev = 0;
+            i += zeros;
+        }
+
+        else if (best == repeatSaving) {
+            out[o + 1] = highByte(w);
+            out[o + 2] = lowByte(w);
+            out[o] = MB_RLE_REPEAT | (repeats - MB_RLE_RUN_MIN);
+            o += 3;
+            prev = w;
+            i += repeats;
+        }
+
+        else {
+            const size_t header = o++;
+            for (uint16_t k = 0; k < deltas; k++, i++) {
+                const uint16_t v = makeWord(in[2*i], in[2*i + 1]);
+                out[o++] = uint8_t(v - prev);
+                prev = v;
+            }
+            out[header] = MB_RLE_DELTA | (deltas - MB_RLE_RUN_MIN);
+        }
+    }
+
+    if (literals != 0) out[literal] = MB_RLE_LITERAL | (literals - 1);
+    return o;
+}
+
+#endif
@@ -11,6 +11,9 @@ enum FUNCTIONS {
     MB_FC_WRITE_HOLDING         = 0x06, // Preset Single Register               4xxxx
     MB_FC_WRITE_COILS           = 0x0F, // Write Multiple Coils (Outputs)       0xxxx
     MB_FC_WRITE_HOLDINGS        = 0x10, // Write block of contiguous registers  4xxxx
+    MB_FC_MASK_WRITE_HOLDING    = 0x16, // Mask Write Register (AND/OR)         4xxxx
+    MB_FC_READ_WRITE_HOLDINGS   = 0x17, // Write then read in one transaction   4xxxx
+    MB_FC_READ_FIFO             = 0x18, // Read FIFO Queue (sampler channels)   3xxxx
 
     // vvv-- subject to change as I work on them --vvv
 
@@ -21,21 +24,33 @@ enum FUNCTIONS {
     MB_FC_ANALOG_READ           = 0x44, // analogRead
     MB_FC_ANALOG_WRITE          = 0x45, // analogWrite
 
-    // I2C
-    /**
+    // Whole-port IO (direct port registers, every pin on a port in one access)
+    MB_FC_PORT_READ             = 0x49, // *portInputRegister(port)
+    MB_FC_PORT_WRITE            = 0x4A, // *portOutputRegister(port), masked
+
+    // Several requests in one frame
+    MB_FC_BATCH                 = 0x48, // [count]([len][request PDU])...
+
+    // I2C bridge
     MB_FC_WIRE_BEGIN_PERIPHERAL = 0x46, // Wire.begin(address)
     MB_FC_WIRE_BEGIN_CONTROLLER = 0x47, // Wire.begin()
     MB_FC_WIRE_END              = 0x64, // Wire.end()
     MB_FC_WIRE_CLK              = 0x65, // Wire.setClock()
-    MB_FC_WIRE_READ             = 0x66, // Wire.readBytes()
-    MB_FC_WIRE_WRITE            = 0x67, // Wire.write()???
+    MB_FC_WIRE_READ             = 0x66, // Wire.requestFrom()
+    MB_FC_WIRE_WRITE            = 0x67, // Wire.beginTransmission() + write() + endTransmission()
+    MB_FC_WIRE_TRANSACTIONS     = 0x68, // [count]([address][write len][bytes][read len])...
 
-    // SPI
-    MB_FC_SPI_BEGIN             = 0x67, // SPI.begin()
-    MB_FC_SPI_END               = 0x68, // SPI.end()
-    MB_FC_SPI_SETTINGS          = 0x69, // SPISettings
-    MB_FC_SPI_TRANSFER          = 0x70, // SPI.transfer()
+    // SPI bridge
+    MB_FC_SPI_BEGIN             = 0x69, // SPI.begin()
+    MB_FC_SPI_END               = 0x6A, // SPI.end()
+    MB_FC_SPI_SETTINGS          = 0x6B, // chip select + SPISettings
+    MB_FC_SPI_TRANSFER          = 0x6C, // SPI.transfer(buffer, count), full duplex
 
+    // Change tracking
+    MB_FC_READ_CHANGES          = 0x6D, // (address, value) pairs changed since a sequence number  3xxxx/4xxxx
+    MB_FC_READ_COMPRESSED       = 0x6E, // Read Inputs/Holdings, run-length/delta coded (compress.h)   3xxxx/4xxxx
+
+    /**
 	//MB_FC_USR_CALLBACK		= 107,	// user-defined callback (maybe)
     **/
 };
@@ -46,6 +61,7 @@ enum EXCEPTIONS {
     MB_EX_ILLEGAL_ADDRESS  = 0x02,  // Given Address Not In Acceptable Range
     MB_EX_ILLEGAL_VALUE    = 0x03,  // Given Value Not In Acceptable Range
     MB_EX_DEVICE_FAILURE    = 0x04, // Arduino Fails To Process Request
+    MB_EX_GATEWAY_TARGET   = 0x0B,  // Bridged Device (e.g. on I2C) Did Not Respond
 };
 
 // Reply Types
@@ -63,4 +79,7 @@ enum REGISTER_T {
     MB_REGISTER_HOLDING =   0x4
 };
 
+// Addresses in each register space: protocol addresses 0..9998 (00001..09999, 10001..19999, ...)
+#define MB_SPACE_SIZE   9999
+
 #endif
\ No newline at end of file
@@ -1,12 +1,14 @@
 #include "Arduino.h"
-#include <util/crc16.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include "crc.h"
+#include "constants.h"
 
 #ifndef ETC_H
 #define ETC_H
 
 static inline const uint16_t bswap16(const uint16_t w) {
+#ifdef __AVR__
     // GCC extended inline ARM assembly snippet for swapping the bytes of 
     // a word without using additional registers :3
     uint16_t copy = w;
@@ -20,27 +22,15 @@ static inline const uint16_t bswap16(const uint16_t w) {
     );
 
     return copy;
+#else
+    // Everywhere else the compiler knows the best way to do this
+    return __builtin_bswap16(w);
+#endif
 }
 
 static inline const uint16_t crc16(const uint8_t * data, const size_t len) {
-    uint16_t crc = 0xffff;
-    for (int i=0; i < len; i++) {
-        // it came free with your fucking xbox
-        // https://github.com/avrdudes/avr-libc/blob/55e8cac69935657bcd3e4d938750960c757844c3/include/util/crc16.h#L113
-        crc = _crc16_update(crc, data[i]);
-    }
-
-    return crc;
-}
-
-static inline const uint8_t * exceptionCodeArray(uint8_t value) {
-    const uint8_t array[1] = {value};
-    return array;
-}
-
-static inline uint8_t * wordToBytes(const uint16_t w) {
-    uint8_t array[2] = {lowByte(w), highByte(w)};
-    return array;
+    // Table-driven, see crc.h (this used to loop avr-libc's bit-serial _crc16_update)
+    return crc16_update(MB_CRC_INIT, data, len);
 }
 
 static inline const uint16_t wordAtOffset(const uint8_t * data, const unsigned int index) {
@@ -57,7 +47,7 @@ static inline const uint8_t reverseBits(const uint8_t b) {
 }
 
 static const void printBytes(const uint8_t * b, size_t l) {
-  for (int i = 0; i < l; i++) {
+  for (size_t i = 0; i < l; i++) {
     Serial.print(b[i], HEX);
     Serial.print(" ");
   }
@@ -1,79 +1,146 @@
 #include <Arduino.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include "etc.h"
 
 #ifndef MODBUS_FRAME_H
 #define MODBUS_FRAME_H
 
-typedef struct CoilArray {
-    bool coils[8] = {0,0,0,0, 0,0,0,0};
+// Modbus RTU frame limits: 1 byte unit id + up to 253 byte PDU + 2 byte CRC
+#define MB_PDU_MAX  253
+#define MB_ADU_MAX  256
 
-    CoilArray(const uint8_t b) {
-        uint8_t _temp = reverseBits(b);
-        for (int i = 0; i < 8; i++) {
-            coils[i] = bitRead(_temp, 0);
-            _temp >>= 1;
-        }
-    }
-};
+// Modbus TCP replaces the address and CRC with a 7 byte MBAP header (transaction id, protocol id,
+// length, unit id). The unit id sits where the RTU address does, so a response frame only needs
+// 6 more bytes in front of it to go out either way.
+#define MB_MBAP_HEADER      7
+#define MB_FRAME_HEADROOM   (MB_MBAP_HEADER - 1)
 
-typedef struct Result {
+// View of a response PDU built in place by a ResponseWriter (owns nothing, never allocates).
+// It's only valid until the writer starts the next response.
+struct Result {
     uint8_t * DATA;
     size_t LEN;
 
     Result() : DATA(nullptr), LEN(0u) {}
-    ~Result() { free(DATA); LEN = 0u; }
+    Result(uint8_t * d, const size_t l) : DATA(d), LEN(l) {}
+
+    const uint8_t getCode() const { return DATA[0]; }
+    const bool isException() const { return DATA[0] & 0x80; }
+};
+
+// Single preallocated response frame that handlers write their PDU straight into.
+// The unit id slot in front and the CRC slot behind are already reserved, so finish() only
+// has to fill those in before the frame goes on the wire - no heap, no intermediate copies.
+// finishMbap() does the same for Modbus TCP, using the headroom in front of the unit id.
+class ResponseWriter {
+    protected:
+        uint8_t buffer[MB_FRAME_HEADROOM + MB_ADU_MAX];
+        size_t pduLen = 0;
+        size_t origin = 0;      // where in the PDU area the next PDU starts (nonzero only inside a batch)
+
+        // [unit id][function code][data ...][crc lo][crc hi]
+        uint8_t * frame() { return buffer + MB_FRAME_HEADROOM; }
+        const uint8_t * frame() const { return buffer + MB_FRAME_HEADROOM; }
+
+    public:
+        ResponseWriter() {}
+
+        uint8_t * pdu() { return frame() + 1 + origin; }
+        const size_t getPduLen() const { return pduLen; }
+        const Result result() { return Result(pdu(), pduLen); }
+
+        // Build the following PDUs 'offset' bytes into the PDU area, after what's already there;
+        // that's how a batch gets its sub-replies written in place. Set it back to 0 to finish.
+        const void setOrigin(const size_t offset) { origin = offset; }
+        const size_t getOrigin() const { return origin; }
+
+        // Longest PDU that still fits from the origin on
+        const size_t room() const { return MB_PDU_MAX - origin; }
+
+        // Start a PDU with 'func'; returns where its data goes. Call setDataLen() once it's written.
+        uint8_t * begin(const uint8_t func) {
+            pdu()[0] = func;
+            pduLen = 1;
+            return pdu() + 1;
+        }
+
+        const void setDataLen(const size_t len) { pduLen = 1 + len; }
+
+        // [func][size][size bytes ...] (register/coil reads); returns where the 'size' bytes go
+        uint8_t * beginBytes(const uint8_t func, const uint8_t size) {
+            uint8_t * data = begin(func);
+            data[0] = size;
+            setDataLen(1u + size);
+            return data + 1;
+        }
+
+        // [func + 0x80][exception]
+        const Result exception(const uint8_t func, const uint8_t code) {
+            uint8_t * data = begin(func | 0x80);
+            data[0] = code;
+            setDataLen(1u);
+            return result();
+        }
 
-    // Construction operators
+        // [func][word][word] (write echoes and other fixed 4 byte replies)
+        const Result words(const uint8_t func, const uint16_t w0, const uint16_t w1) {
+            uint8_t * data = begin(func);
+            data[0] = highByte(w0);
+            data[1] = lowByte(w0);
+            data[2] = highByte(w1);
+            data[3] = lowByte(w1);
+            setDataLen(4u);
+            return result();
+        }
+
+        // Relabel the PDU built so far as a reply to 'func' (keeps the exception bit), for functions
+        // built out of other handlers
+        const Result retag(const uint8_t func) {
+            pdu()[0] = (pdu()[0] & 0x80) | func;
+            return result();
+        }
 
-    const Result& operator= (const Result& assign) {
-        if (this != &assign) {
-            this->~Result();
-            this->LEN = assign.LEN;
-            this->DATA = (uint8_t *)calloc(assign.LEN, sizeof(uint8_t));
-            memcpy(this->DATA, assign.DATA, assign.LEN);
+        // Take a frame that is already finished (unit id, PDU, CRC) as the reply, e.g. one kept by
+        // a ResponseCache; the frame is then sent as it is, without finish()
+        const Result load(const uint8_t * adu, const size_t len) {
+            origin = 0;
+            memcpy(frame(), adu, len);
+            pduLen = len - 3;
+            return result();
         }
 
-        return *this;
-    }
-
-    Result(const Result& copy) {
-        this->~Result();
-        this->LEN = copy.LEN;
-        this->DATA = (uint8_t *)calloc(copy.LEN, sizeof(uint8_t));
-        memcpy(this->DATA, copy.DATA, copy.LEN);
-    }
-
-    // Various other constructors for Modbus functions
-
-    Result(const uint8_t function, const uint8_t exception) 
-    : LEN(2u), 
-      DATA((uint8_t *)calloc(2u, sizeof(uint8_t))) {
-        DATA[0] = function + 0x80;
-        DATA[1] = exception;
-    }
-
-    Result(const uint8_t func, const uint8_t size, const uint8_t * data)
-    : LEN(2u + size),
-      DATA((uint8_t *)calloc(size + 2u, sizeof(uint8_t))) {
-        DATA[0] = func;
-        DATA[1] = size;
-        memcpy(DATA+2, data, (size_t)size);
-    }
-
-    Result(const uint8_t func, const uint16_t addr, const uint16_t amt)
-    : LEN(5u),
-      DATA((uint8_t *)calloc(5u, sizeof(uint8_t))) {
-        DATA[0] = func;
-        DATA[1] = highByte(addr);
-        DATA[2] = lowByte(addr);
-        DATA[3] = highByte(amt);
-        DATA[4] = lowByte(amt);
-    }
+        // Fill in the unit id and CRC around the PDU; returns the length of the ADU at adu()
+        const size_t finish(const uint8_t unitId) {
+            frame()[0] = unitId;
+            const size_t len = 1 + pduLen;
+            const uint16_t crc = crc16(frame(), len);
+            frame()[len] = lowByte(crc);
+            frame()[len + 1] = highByte(crc);
+            return len + 2;
+        }
+
+        const uint8_t * adu() const { return frame(); }
+
+        // Fill in the MBAP header in front of the PDU; returns the length of the ADU at mbap()
+        const size_t finishMbap(const uint16_t transaction, const uint8_t unitId) {
+            uint8_t * header = buffer;
+            header[0] = highByte(transaction);
+            header[1] = lowByte(transaction);
+            header[2] = 0;                      // protocol id: Modbus
+            header[3] = 0;
+            header[4] = highByte(1 + pduLen);   // length: unit id + PDU
+            header[5] = lowByte(1 + pduLen);
+            frame()[0] = unitId;
+            return MB_MBAP_HEADER + pduLen;
+        }
+
+        const uint8_t * mbap() const { return buffer; }
+        const void print() const { printBytes(frame(), pduLen + 3); }
 };
 
-typedef struct PDU_T {
+struct PDU_T {
     uint8_t * data;
     size_t len;
 
@@ -86,7 +153,7 @@ typedef struct PDU_T {
     const void setCode(const uint8_t code) { *codePtr() = code; }
 };
 
-typedef struct ADU_T {
+struct ADU_T {
     uint8_t * data;
     size_t len;
     PDU_T pdu;
@@ -100,31 +167,4 @@ typedef struct ADU_T {
     const void setAddr(const uint8_t addr) { *addrPtr() = addr; }
 };
 
-typedef struct Packet {
-    uint8_t * data;
-    size_t len;
-    ADU_T adu;
-
-    Packet() : data(nullptr), len(0u), adu() {}
-
-    Packet(const size_t l) {
-        data = (uint8_t *)calloc(l, sizeof(uint8_t));
-        len = l;
-        adu = ADU_T(data, l - 2);
-    }
-
-    const void resetPacket() { memset(data+1, 0u, len-1); }
-    uint16_t * crcPtr() const { return (uint16_t *)(data + (len - 2)); }
-    const void updateCRC() { *crcPtr() =  crc16(data, len-2); }
-    const uint16_t calcCRC() const { return crc16(data, len-2); }
-    const bool checkCRC() const { return *crcPtr() == calcCRC(); }
-    const void updateFromResult(const Result& r) {
-        this->resetPacket();
-        this->len = r.LEN + 3;
-        memcpy(data + 1, r.DATA, r.LEN);
-        this->updateCRC();
-    }
-    const void print() const { printBytes(this->data, this->len); }
-};
-
 #endif
\ No newline at end of file
@@ -0,0 +1,112 @@
+/*
+    FdStream.cpp - Arduino Streams over file descriptors for the host build
+*/
+
+#include "FdStream.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+
+const void FdStream::adopt(const int newFd) {
+    close();
+    fd = newFd;
+    if (fd >= 0) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+const void FdStream::close() {
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+    rxHead = rxTail = 0;
+}
+
+const size_t FdStream::fill() {
+    if (rxHead < rxTail) return rxTail - rxHead;
+    rxHead = rxTail = 0;
+    if (fd < 0) return 0;
+
+    const ssize_t n = ::read(fd, rxBuf, sizeof(rxBuf));
+    if (n > 0) rxTail = size_t(n);
+    return rxTail;
+}
+
+const bool FdStream::waitReadable(const long timeoutUs) {
+    if (rxHead < rxTail) return true;
+    if (fd < 0) return false;
+
+    struct pollfd p = {fd, POLLIN, 0};
+    struct timespec ts = {timeoutUs / 1000000, (timeoutUs % 1000000) * 1000};
+    return ppoll(&p, 1, &ts, nullptr) > 0;
+}
+
+int FdStream::available() { return int(fill()); }
+
+int FdStream::read() {
+    if (fill() == 0) return -1;
+    return rxBuf[rxHead++];
+}
+
+int FdStream::peek() {
+    if (fill() == 0) return -1;
+    return rxBuf[rxHead];
+}
+
+size_t FdStream::write(uint8_t b) { return write(&b, 1); }
+
+size_t FdStream::write(const uint8_t * buffer, size_t size) {
+    size_t sent = 0;
+
+    while (fd >= 0 && sent < size) {
+        const ssize_t n = ::write(fd, buffer + sent, size - sent);
+        if (n > 0) { sent += size_t(n); continue; }
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) break;
+
+        // Like a full UART TX buffer: wait for room
+        struct pollfd p = {fd, POLLOUT, 0};
+        poll(&p, 1, 100);
+    }
+
+    return sent;
+}
+
+PtyStream::~PtyStream() {
+    if (peerFd >= 0) ::close(peerFd);
+}
+
+const bool PtyStream::open() {
+    const int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0) return false;
+
+    if (grantpt(master) != 0 || unlockpt(master) != 0 || ptsname_r(master, peerPath, sizeof(peerPath)) != 0) {
+        ::close(master);
+        return false;
+    }
+
+    peerFd = ::open(peerPath, O_RDWR | O_NOCTTY);
+    if (peerFd < 0) {
+        ::close(master);
+        return false;
+    }
+
+    // Raw 8-bit line: no echo, no CR/LF translation, no signals
+    struct termios tio;
+    tcgetattr(peerFd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(peerFd, TCSANOW, &tio);
+
+    adopt(master);
+    return true;
+}
+
+const bool socketStreamPair(FdStream& a, FdStream& b) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) return false;
+    a.adopt(fds[0]);
+    b.adopt(fds[1]);
+    return true;
+}
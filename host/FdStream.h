@@ -0,0 +1,67 @@
+/*
+    FdStream.h - Arduino Streams over file descriptors for the host build
+
+    PtyStream gives the process a pseudo-terminal that any Modbus master (or socat, pymodbus, ...)
+    can open as a serial port; socketStreamPair() connects two Streams inside one process for tests
+    and benchmarks. Both are non-blocking, like a UART: available() says what's there, read()
+    never waits.
+*/
+
+#ifndef HOST_FDSTREAM_H
+#define HOST_FDSTREAM_H
+
+#include <Arduino.h>
+#include <Stream.h>
+
+class FdStream : public Stream {
+    protected:
+        int fd = -1;
+        uint8_t rxBuf[256];
+        size_t rxHead = 0;
+        size_t rxTail = 0;
+
+        const size_t fill();
+
+    public:
+        FdStream() {}
+        explicit FdStream(const int fd) { adopt(fd); }
+        ~FdStream() { close(); }
+
+        FdStream(const FdStream&) = delete;
+        FdStream& operator= (const FdStream&) = delete;
+
+        // Take ownership of 'fd' and switch it to non-blocking
+        const void adopt(const int fd);
+        const void close();
+        const int handle() const { return fd; }
+        const bool isOpen() const { return fd >= 0; }
+
+        // Block for up to 'timeoutUs' until there's something to read (false on timeout)
+        const bool waitReadable(const long timeoutUs);
+
+        int available() override;
+        int read() override;
+        int peek() override;
+        size_t write(uint8_t b) override;
+        size_t write(const uint8_t * buffer, size_t size) override;
+        using Print::write;
+};
+
+class PtyStream : public FdStream {
+    protected:
+        int peerFd = -1;            // held open so reads don't fail while no client has the port
+        char peerPath[64] = {0};
+
+    public:
+        PtyStream() {}
+        ~PtyStream();
+
+        // Create the pty in raw mode; peerName() is the path to hand to the Modbus master
+        const bool open();
+        const char * peerName() const { return peerPath; }
+};
+
+// Connect 'a' and 'b' back to back over a socketpair
+const bool socketStreamPair(FdStream& a, FdStream& b);
+
+#endif // HOST_FDSTREAM_H
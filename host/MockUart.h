@@ -0,0 +1,64 @@
+/*
+    MockUart.h - UartTransport with the interrupts simulated in software, for the host build
+*/
+
+#include "../transport.h"
+
+#ifndef MODBUS_MOCK_UART_H
+#define MODBUS_MOCK_UART_H
+
+#define MOCK_UART_WIRE_MAX 1024
+
+// inject() plays the receive ISR, drain() plays the data-register-empty and transmit-complete ISRs.
+// Every byte that "goes out" is recorded along with the DE pin level it went out with, so tests and
+// benchmarks can check the RS-485 turnaround.
+class MockUart : public UartTransport {
+    protected:
+        bool txInterrupt = false;
+
+        void enableTxInterrupt() override { txInterrupt = true; }
+        void waitForTxSpace() override { drainOne(); }
+        void writeDriverEnable(const bool on) override { driverEnabled = on; if (on) deRises++; }
+
+        const bool drainOne() {
+            uint8_t b;
+            if (txInterrupt && onTxReady(b)) {
+                if (wireLen < MOCK_UART_WIRE_MAX) {
+                    wire[wireLen] = b;
+                    wireDriven[wireLen] = driverEnabled;
+                    wireLen++;
+                }
+                return true;
+            }
+
+            // Ring empty: UDRE disables itself, then the last stop bit finishes
+            txInterrupt = false;
+            onTxComplete();
+            return false;
+        }
+
+    public:
+        uint8_t wire[MOCK_UART_WIRE_MAX];
+        bool wireDriven[MOCK_UART_WIRE_MAX];
+        size_t wireLen = 0;
+        bool driverEnabled = false;
+        unsigned int deRises = 0;
+
+        MockUart() {}
+
+        // Deliver bytes as if they'd just come off the line
+        const void inject(const uint8_t * data, const size_t len) {
+            for (size_t i = 0; i < len; i++) onRxByte(data[i]);
+        }
+
+        // Run the transmit interrupts until everything queued is on the wire; returns bytes sent
+        const size_t drain() {
+            const size_t before = wireLen;
+            while (drainOne()) {}
+            return wireLen - before;
+        }
+
+        const void clearWire() { wireLen = 0; deRises = 0; }
+};
+
+#endif // MODBUS_MOCK_UART_H
@@ -0,0 +1,57 @@
+/*
+    RegisterDecoder.h - Controller side of Read Compressed (0x6E)
+
+    Turns the coded block of a 0x6E reply back into register values. The format is described in
+    compress.h; this is the inverse of compressRegisters().
+*/
+
+#ifndef HOST_REGISTER_DECODER_H
+#define HOST_REGISTER_DECODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "../compress.h"
+
+// Decode 'len' coded bytes at 'in' into at most 'max' registers at 'out'. Returns how many registers
+// they held, or -1 if the block is malformed (a token cut short, or more registers than 'max').
+static inline long decodeRegisters(const uint8_t * in, const size_t len, uint16_t * out, const size_t max) {
+    size_t pos = 0;
+    size_t n = 0;
+    uint16_t prev = 0;
+
+    while (pos < len) {
+        const uint8_t token = in[pos++];
+        size_t count;
+
+        if ((token & 0x80) == MB_RLE_LITERAL) {
+            count = (token & 0x7F) + 1u;
+            if (n + count > max || pos + 2 * count > len) return -1;
+            for (size_t k = 0; k < count; k++, pos += 2) out[n++] = prev = uint16_t(in[pos] << 8 | in[pos + 1]);
+        }
+
+        else if ((token & 0xC0) == MB_RLE_ZEROS) {
+            count = (token & 0x3F) + 1u;
+            if (n + count > max) return -1;
+            for (size_t k = 0; k < count; k++) out[n++] = 0;
+            prev = 0;
+        }
+
+        else if ((token & 0xE0) == MB_RLE_REPEAT) {
+            count = (token & 0x1F) + size_t(MB_RLE_RUN_MIN);
+            if (n + count > max || pos + 2 > len) return -1;
+            prev = uint16_t(in[pos] << 8 | in[pos + 1]);
+            pos += 2;
+            for (size_t k = 0; k < count; k++) out[n++] = prev;
+        }
+
+        else {
+            count = (token & 0x1F) + size_t(MB_RLE_RUN_MIN);
+            if (n + count > max || pos + count > len) return -1;
+            for (size_t k = 0; k < count; k++) out[n++] = prev = uint16_t(prev + int8_t(in[pos++]));
+        }
+    }
+
+    return long(n);
+}
+
+#endif // HOST_REGISTER_DECODER_H
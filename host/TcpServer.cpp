@@ -0,0 +1,192 @@
+/*
+    TcpServer.cpp - Event-driven Modbus TCP server for the host build
+*/
+
+#include "TcpServer.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define _TCP_MAX_EVENTS 64
+#define _TCP_MAX_ROUNDS 16      // reads per connection per wakeup, so one busy controller can't starve the rest
+
+TcpServer::TcpServer(TcpModmata& p, const size_t max) : peripheral(p), maxClients(max) {
+    connections = new Connection[maxClients];
+}
+
+TcpServer::~TcpServer() {
+    end();
+    delete[] connections;
+}
+
+const bool TcpServer::begin(const uint16_t port) {
+    end();
+
+    listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd < 0) return false;
+
+    const int on = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    socklen_t addrLen = sizeof(addr);
+    if (bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+        || ::listen(listenFd, SOMAXCONN) < 0
+        || getsockname(listenFd, (struct sockaddr *)&addr, &addrLen) < 0) {
+        end();
+        return false;
+    }
+    boundPort = ntohs(addr.sin_port);
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;      // the listening socket; connections carry their Connection*
+    if (epollFd < 0 || epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev) < 0) {
+        end();
+        return false;
+    }
+
+    return true;
+}
+
+const void TcpServer::end() {
+    for (size_t i = 0; i < maxClients; i++) close(connections[i]);
+    if (epollFd >= 0) ::close(epollFd);
+    if (listenFd >= 0) ::close(listenFd);
+    epollFd = listenFd = -1;
+    boundPort = 0;
+}
+
+const bool TcpServer::poll(const int timeoutMs) {
+    struct epoll_event events[_TCP_MAX_EVENTS];
+
+    const int n = epoll_wait(epollFd, events, _TCP_MAX_EVENTS, timeoutMs);
+    if (n < 0) return errno == EINTR;
+
+    for (int i = 0; i < n; i++) {
+        Connection * c = (Connection *)events[i].data.ptr;
+        if (c == nullptr) { accept(); continue; }
+        if (c->fd < 0) continue;    // closed earlier in this batch
+
+        if ((events[i].events & (EPOLLERR | EPOLLHUP)) && !(events[i].events & EPOLLIN)) close(*c);
+        else if (!service(*c)) close(*c);
+    }
+
+    return true;
+}
+
+const void TcpServer::accept() {
+    for (;;) {
+        const int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;     // EAGAIN: nothing more waiting
+
+        Connection * c = nullptr;
+        for (size_t i = 0; i < maxClients && c == nullptr; i++)
+            if (connections[i].fd < 0) c = &connections[i];
+
+        if (c == nullptr) { ::close(fd); continue; }   // full; the controller will retry
+
+        // Replies are whole frames, written once each; don't hold them back for coalescing
+        const int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        c->fd = fd;
+        c->writing = false;
+        c->peerClosed = false;
+        c->rx.reset();
+        c->txHead = c->txTail = 0;
+
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = c;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) { ::close(fd); c->fd = -1; continue; }
+
+        clientCount++;
+    }
+}
+
+const void TcpServer::close(Connection& c) {
+    if (c.fd < 0) return;
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, c.fd, nullptr);
+    ::close(c.fd);
+    c.fd = -1;
+    clientCount--;
+}
+
+const void TcpServer::watch(Connection& c, const bool writing) {
+    if (c.writing == writing) return;
+    c.writing = writing;
+
+    struct epoll_event ev = {};
+    ev.events = writing ? EPOLLOUT : (EPOLLIN | EPOLLRDHUP);
+    ev.data.ptr = &c;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, c.fd, &ev);
+}
+
+const bool TcpServer::flush(Connection& c) {
+    while (c.txHead < c.txTail) {
+        const ssize_t n = ::send(c.fd, c.tx + c.txHead, c.txTail - c.txHead, MSG_NOSIGNAL);
+        if (n > 0) { c.txHead += size_t(n); continue; }
+        if (n < 0 && errno == EINTR) continue;
+        return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+
+    c.txHead = c.txTail = 0;
+    return true;
+}
+
+// Read, answer and write for one connection until the socket would block; false to close it
+const bool TcpServer::service(Connection& c) {
+    for (int round = 0; round < _TCP_MAX_ROUNDS; round++) {
+        // Answer every buffered request there's reply space for
+        const uint8_t * frame;
+        size_t len;
+        size_t answered = 0;
+        while (sizeof(c.tx) - c.txTail >= MB_TCP_ADU_MAX && c.rx.next(frame, len)) {
+            const size_t n = peripheral.serve(frame, len);
+            memcpy(c.tx + c.txTail, peripheral.response.mbap(), n);
+            c.txTail += n;
+            answered++;
+        }
+        requests += answered;
+
+        if (c.rx.framingError()) {
+            peripheral.telemetry.countFrame(STATE_RXERROR);
+            return false;
+        }
+
+        if (!flush(c)) return false;
+
+        // Replies still queued: stop reading this controller until it takes them
+        if (c.txHead < c.txTail) { watch(c, true); return true; }
+        watch(c, false);
+
+        // The controller has hung up: close once everything it sent has been answered
+        if (c.peerClosed) {
+            if (answered > 0) continue;
+            return false;
+        }
+
+        uint8_t * space = c.rx.space();
+        const size_t room = c.rx.room();
+        if (room == 0) return false;
+
+        const ssize_t n = ::recv(c.fd, space, room, 0);
+        if (n > 0) { c.rx.commit(size_t(n)); continue; }
+        if (n == 0) { c.peerClosed = true; continue; }     // answer what's buffered, then close
+        if (errno == EINTR) continue;
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+
+    return true;    // more to do; level-triggered epoll comes back to it
+}
@@ -0,0 +1,72 @@
+/*
+    TcpServer.h - Event-driven Modbus TCP server for the host build
+
+    One epoll loop serves any number of controller connections against a single TcpModmata (and so
+    a single register table). Every connection has its own MBAP receive buffer, so a controller can
+    pipeline requests: all complete frames that have arrived are answered in order, their replies
+    collected and sent with one write. A controller that stops reading its replies stops being
+    read from until it catches up, rather than growing the buffers.
+*/
+
+#ifndef HOST_TCPSERVER_H
+#define HOST_TCPSERVER_H
+
+#include <Arduino.h>
+#include "../ModbusTCP.h"
+
+#ifndef MB_TCP_TX_BUFFER
+#define MB_TCP_TX_BUFFER    8192    // replies queued per connection
+#endif
+
+#ifndef MB_TCP_MAX_CLIENTS
+#define MB_TCP_MAX_CLIENTS  64
+#endif
+
+class TcpServer {
+    protected:
+        struct Connection {
+            int             fd = -1;
+            bool            writing = false;    // waiting for EPOLLOUT instead of EPOLLIN
+            bool            peerClosed = false;
+            MbapReceiver    rx;
+            uint8_t         tx[MB_TCP_TX_BUFFER];
+            size_t          txHead = 0;
+            size_t          txTail = 0;
+        };
+
+        TcpModmata&     peripheral;
+        Connection *    connections = nullptr;
+        size_t          maxClients;
+        size_t          clientCount = 0;
+        int             listenFd = -1;
+        int             epollFd = -1;
+        uint16_t        boundPort = 0;
+        unsigned long   requests = 0;
+
+        const void accept();
+        const void close(Connection& c);
+        const bool service(Connection& c);
+        const bool flush(Connection& c);
+        const void watch(Connection& c, const bool writing);
+
+    public:
+        TcpServer(TcpModmata& peripheral, const size_t maxClients = MB_TCP_MAX_CLIENTS);
+        ~TcpServer();
+
+        TcpServer(const TcpServer&) = delete;
+        TcpServer& operator= (const TcpServer&) = delete;
+
+        // Listen on 'port' (0 picks a free one, see port()) on all interfaces
+        const bool begin(const uint16_t port = MB_TCP_PORT);
+        const void end();
+
+        // Wait up to 'timeoutMs' (-1: forever) for network events and handle them all.
+        // Returns false if waiting failed.
+        const bool poll(const int timeoutMs);
+
+        const uint16_t port() const { return boundPort; }
+        const size_t clients() const { return clientCount; }
+        const unsigned long served() const { return requests; }
+};
+
+#endif // HOST_TCPSERVER_H
@@ -0,0 +1,172 @@
+/*
+    Arduino.cpp - Host implementations of the Arduino core functions in Arduino.h
+*/
+
+#include "Arduino.h"
+#include "Wire.h"
+#include "SPI.h"
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+// Timing
+
+static uint64_t nowMicros() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static const uint64_t startMicros = nowMicros();
+static uint64_t skippedMicros = 0;
+
+unsigned long micros() { return (unsigned long)(nowMicros() - startMicros + skippedMicros); }
+unsigned long millis() { return (unsigned long)((nowMicros() - startMicros + skippedMicros) / 1000ull); }
+void hostAdvanceMicros(unsigned long us) { skippedMicros += us; }
+void delay(unsigned long ms) { usleep(ms * 1000ul); }
+void delayMicroseconds(unsigned int us) { usleep(us); }
+
+// GPIO
+
+volatile uint8_t hostPortOut[HOST_NUM_PORTS + 1];
+volatile uint8_t hostPortIn[HOST_NUM_PORTS + 1];
+volatile uint8_t hostPortMode[HOST_NUM_PORTS + 1];
+uint16_t hostAnalogIn[NUM_ANALOG_INPUTS];
+int hostAnalogOut[NUM_DIGITAL_PINS];
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    const uint8_t port = digitalPinToPort(pin);
+    if (port == NOT_A_PIN) return;
+
+    const uint8_t mask = digitalPinToBitMask(pin);
+    if (mode == OUTPUT) hostPortMode[port] |= mask;
+    else                hostPortMode[port] &= ~mask;
+
+    // Pull-ups read high until something drives the pin
+    if (mode == INPUT_PULLUP) hostPortIn[port] |= mask;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+    const uint8_t port = digitalPinToPort(pin);
+    if (port == NOT_A_PIN) return;
+
+    const uint8_t mask = digitalPinToBitMask(pin);
+    if (val == LOW) hostPortOut[port] &= ~mask;
+    else            hostPortOut[port] |= mask;
+}
+
+int digitalRead(uint8_t pin) {
+    const uint8_t port = digitalPinToPort(pin);
+    if (port == NOT_A_PIN) return LOW;
+
+    // An output reads back the level it drives, like the PINx register on an AVR
+    const uint8_t mask = digitalPinToBitMask(pin);
+    const uint8_t level = (hostPortIn[port] & ~hostPortMode[port]) | (hostPortOut[port] & hostPortMode[port]);
+    return (level & mask) ? HIGH : LOW;
+}
+
+int analogRead(uint8_t pin) {
+    return pin < NUM_ANALOG_INPUTS ? hostAnalogIn[pin] : 0;
+}
+
+void analogWrite(uint8_t pin, int val) {
+    if (pin < NUM_DIGITAL_PINS) hostAnalogOut[pin] = val;
+}
+
+void hostSetPin(uint8_t pin, uint8_t level) {
+    const uint8_t port = digitalPinToPort(pin);
+    if (port == NOT_A_PIN) return;
+
+    const uint8_t mask = digitalPinToBitMask(pin);
+    if (level == LOW) hostPortIn[port] &= ~mask;
+    else              hostPortIn[port] |= mask;
+}
+
+void hostSetAnalog(uint8_t pin, uint16_t value) {
+    if (pin < NUM_ANALOG_INPUTS) hostAnalogIn[pin] = value;
+}
+
+// Print
+
+size_t Print::write(const uint8_t * buffer, size_t size) {
+    size_t n = 0;
+    while (size--) n += write(*buffer++);
+    return n;
+}
+
+size_t Print::write(const char * str) {
+    return str == nullptr ? 0 : write((const uint8_t *)str, strlen(str));
+}
+
+size_t Print::printNumber(unsigned long n, uint8_t base) {
+    char buf[8 * sizeof(long) + 1];
+    char * str = &buf[sizeof(buf) - 1];
+    *str = '\0';
+
+    if (base < 2) base = 10;
+    do {
+        const char c = n % base;
+        n /= base;
+        *--str = c < 10 ? c + '0' : c + 'A' - 10;
+    } while (n);
+
+    return write(str);
+}
+
+size_t Print::print(const char str[]) { return write(str); }
+size_t Print::print(char c) { return write(uint8_t(c)); }
+size_t Print::print(unsigned char n, int base) { return printNumber(n, base); }
+size_t Print::print(int n, int base) { return print(long(n), base); }
+size_t Print::print(unsigned int n, int base) { return printNumber(n, base); }
+size_t Print::print(unsigned long n, int base) { return printNumber(n, base); }
+
+size_t Print::print(long n, int base) {
+    if (base == 10 && n < 0) return print('-') + printNumber((unsigned long)(-n), 10);
+    return printNumber((unsigned long)n, base);
+}
+
+size_t Print::print(double n, int digits) {
+    char buf[48];
+    snprintf(buf, sizeof(buf), "%.*f", digits, n);
+    return write(buf);
+}
+
+size_t Print::println() { return write("\r\n"); }
+
+// Stream
+
+size_t Stream::readBytes(uint8_t * buffer, size_t length) {
+    size_t count = 0;
+    const unsigned long start = millis();
+
+    while (count < length) {
+        const int c = read();
+        if (c >= 0) { buffer[count++] = uint8_t(c); continue; }
+        if (millis() - start >= _timeout) break;
+        usleep(100);
+    }
+
+    return count;
+}
+
+// Serial
+
+int HardwareSerial::available() { return backend ? backend->available() : 0; }
+int HardwareSerial::read() { return backend ? backend->read() : -1; }
+int HardwareSerial::peek() { return backend ? backend->peek() : -1; }
+void HardwareSerial::flush() { if (backend) backend->flush(); else fflush(stdout); }
+
+size_t HardwareSerial::write(uint8_t b) {
+    if (backend) return backend->write(b);
+    return fwrite(&b, 1, 1, stdout);
+}
+
+size_t HardwareSerial::write(const uint8_t * buffer, size_t size) {
+    if (backend) return backend->write(buffer, size);
+    return fwrite(buffer, 1, size, stdout);
+}
+
+HardwareSerial Serial;
+TwoWire Wire;
+SPIClass SPI;
@@ -0,0 +1,101 @@
+/*
+    Arduino.h - Minimal Arduino core for building the library as a Linux process
+
+    Only what this library and its sketch use: timing, GPIO (simulated ports), Print/Stream and a
+    Serial whose backend can be swapped for a pty or socket (see host/FdStream.h).
+*/
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define HIGH            0x1
+#define LOW             0x0
+
+#define INPUT           0x0
+#define OUTPUT          0x1
+#define INPUT_PULLUP    0x2
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define LSBFIRST 0
+#define MSBFIRST 1
+
+#define SERIAL_8N1 0x06
+#define SERIAL_8E1 0x26
+#define SERIAL_8O1 0x36
+#define SERIAL_8N2 0x0E
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define memcpy_P(dst, src, n) memcpy((dst), (src), (n))
+
+#define lowByte(w)  ((uint8_t) ((w) & 0xff))
+#define highByte(w) ((uint8_t) ((w) >> 8))
+
+#define bitRead(value, bit)             (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit)              ((value) |= (1UL << (bit)))
+#define bitClear(value, bit)            ((value) &= ~(1UL << (bit)))
+#define bitWrite(value, bit, bitvalue)  ((bitvalue) ? bitSet(value, bit) : bitClear(value, bit))
+#define bit(b)                          (1UL << (b))
+
+typedef bool boolean;
+typedef uint8_t byte;
+typedef unsigned int word;
+
+static inline uint16_t makeWord(const uint8_t h, const uint8_t l) { return (uint16_t(h) << 8) | l; }
+
+// Timing (CLOCK_MONOTONIC since the process started)
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+// Move millis()/micros() forward without sleeping (for replaying line timing in tests and benchmarks)
+void hostAdvanceMicros(unsigned long us);
+
+static inline void noInterrupts() {}
+static inline void interrupts() {}
+
+// Simulated GPIO: NUM_DIGITAL_PINS pins on 8-bit ports, pin n is bit (n % 8) of port (n / 8) + 1.
+// Tests and tools drive inputs with hostSetPin()/hostSetAnalog().
+#define NUM_DIGITAL_PINS    24
+#define NUM_ANALOG_INPUTS   8
+#define HOST_NUM_PORTS      (NUM_DIGITAL_PINS / 8)
+#define NOT_A_PIN           0
+#define NOT_A_PORT          0
+
+extern volatile uint8_t hostPortOut[HOST_NUM_PORTS + 1];
+extern volatile uint8_t hostPortIn[HOST_NUM_PORTS + 1];
+extern volatile uint8_t hostPortMode[HOST_NUM_PORTS + 1];
+extern uint16_t hostAnalogIn[NUM_ANALOG_INPUTS];
+extern int hostAnalogOut[NUM_DIGITAL_PINS];
+
+#define digitalPinToPort(p)     ((p) < NUM_DIGITAL_PINS ? uint8_t((p) / 8 + 1) : uint8_t(NOT_A_PIN))
+#define digitalPinToBitMask(p)  (uint8_t(1u << ((p) % 8)))
+#define portOutputRegister(P)   (&hostPortOut[(P)])
+#define portInputRegister(P)    (&hostPortIn[(P)])
+#define portModeRegister(P)     (&hostPortMode[(P)])
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+void analogWrite(uint8_t pin, int val);
+
+void hostSetPin(uint8_t pin, uint8_t level);
+void hostSetAnalog(uint8_t pin, uint16_t value);
+
+#include "Print.h"
+#include "Stream.h"
+#include "HardwareSerial.h"
+
+#endif // HOST_ARDUINO_H
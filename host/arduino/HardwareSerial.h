@@ -0,0 +1,39 @@
+/*
+    HardwareSerial.h - Host Serial
+
+    Forwards to whatever Stream is attached (a pty or socket from host/FdStream.h); with nothing
+    attached, output goes to stdout and there is never any input.
+*/
+
+#ifndef HOST_HARDWARESERIAL_H
+#define HOST_HARDWARESERIAL_H
+
+#include "Stream.h"
+
+class HardwareSerial : public Stream {
+    protected:
+        Stream * backend = nullptr;
+        unsigned long baud = 0;
+
+    public:
+        void attach(Stream& s) { backend = &s; }
+        void detach() { backend = nullptr; }
+
+        void begin(unsigned long b, uint8_t config = 0) { baud = b; (void)config; }
+        void end() {}
+        unsigned long getBaud() const { return baud; }
+
+        int available() override;
+        int read() override;
+        int peek() override;
+        size_t write(uint8_t b) override;
+        size_t write(const uint8_t * buffer, size_t size) override;
+        void flush() override;
+        using Print::write;
+
+        operator bool() { return true; }
+};
+
+extern HardwareSerial Serial;
+
+#endif // HOST_HARDWARESERIAL_H
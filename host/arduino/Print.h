@@ -0,0 +1,38 @@
+/*
+    Print.h - Host stand-in for the Arduino Print class
+*/
+
+#ifndef HOST_PRINT_H
+#define HOST_PRINT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+class Print {
+    protected:
+        size_t printNumber(unsigned long n, uint8_t base);
+
+    public:
+        virtual ~Print() {}
+
+        virtual size_t write(uint8_t b) = 0;
+        virtual size_t write(const uint8_t * buffer, size_t size);
+        size_t write(const char * str);
+        virtual int availableForWrite() { return 0; }
+        virtual void flush() {}
+
+        size_t print(const char str[]);
+        size_t print(char c);
+        size_t print(unsigned char n, int base = 10);
+        size_t print(int n, int base = 10);
+        size_t print(unsigned int n, int base = 10);
+        size_t print(long n, int base = 10);
+        size_t print(unsigned long n, int base = 10);
+        size_t print(double n, int digits = 2);
+
+        size_t println();
+        template <typename T> size_t println(T v) { return print(v) + println(); }
+        template <typename T> size_t println(T v, int base) { return print(v, base) + println(); }
+};
+
+#endif // HOST_PRINT_H
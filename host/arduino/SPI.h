@@ -0,0 +1,53 @@
+/*
+    SPI.h - Host stand-in for the Arduino SPI library
+
+    MISO is looped back to MOSI, so every transfer reads back what it sent, unless hostDevice is set:
+    then each byte sent is passed to it and it returns the byte to clock back in.
+*/
+
+#ifndef HOST_SPI_H
+#define HOST_SPI_H
+
+#include "Arduino.h"
+
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x04
+#define SPI_MODE2 0x08
+#define SPI_MODE3 0x0C
+
+class SPISettings {
+    public:
+        uint32_t clock;
+        uint8_t bitOrder;
+        uint8_t dataMode;
+
+        SPISettings() : clock(4000000), bitOrder(MSBFIRST), dataMode(SPI_MODE0) {}
+        SPISettings(uint32_t c, uint8_t o, uint8_t m) : clock(c), bitOrder(o), dataMode(m) {}
+};
+
+class SPIClass {
+    public:
+        uint8_t (*hostDevice)(uint8_t mosi) = nullptr;
+        SPISettings hostSettings;               // of the last beginTransaction()
+        bool hostInTransaction = false;
+        unsigned long hostBytes = 0;            // bytes transferred, for tests
+
+        void begin() {}
+        void end() {}
+        void beginTransaction(SPISettings settings) { hostSettings = settings; hostInTransaction = true; }
+        void endTransaction() { hostInTransaction = false; }
+
+        uint8_t transfer(uint8_t data) {
+            hostBytes++;
+            return hostDevice != nullptr ? hostDevice(data) : data;
+        }
+
+        void transfer(void * buf, size_t count) {
+            uint8_t * bytes = (uint8_t *)buf;
+            for (size_t i = 0; i < count; i++) bytes[i] = transfer(bytes[i]);
+        }
+};
+
+extern SPIClass SPI;
+
+#endif // HOST_SPI_H
@@ -0,0 +1,26 @@
+/*
+    Stream.h - Host stand-in for the Arduino Stream class
+*/
+
+#ifndef HOST_STREAM_H
+#define HOST_STREAM_H
+
+#include "Print.h"
+
+class Stream : public Print {
+    protected:
+        unsigned long _timeout = 1000;
+
+    public:
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int peek() = 0;
+
+        void setTimeout(unsigned long timeout) { _timeout = timeout; }
+
+        // Like Arduino's: waits up to the timeout for each byte
+        size_t readBytes(uint8_t * buffer, size_t length);
+        size_t readBytes(char * buffer, size_t length) { return readBytes((uint8_t *)buffer, length); }
+};
+
+#endif // HOST_STREAM_H
@@ -0,0 +1,121 @@
+/*
+    Wire.h - Host stand-in for the Arduino TwoWire library
+
+    Controller side only, against simulated devices: Wire.hostDevice() puts a register-file device
+    (the usual sensor/EEPROM shape) on the bus at an address. The first byte written to it sets its
+    register pointer, further bytes are stored from there, and reads return bytes from the pointer
+    on; the pointer wraps at the end of the device's memory. An address with no device NACKs.
+*/
+
+#ifndef HOST_WIRE_H
+#define HOST_WIRE_H
+
+#include "Arduino.h"
+
+#define BUFFER_LENGTH           32      // same as the AVR core
+#define HOST_WIRE_DEVICES       8
+
+class TwoWire : public Stream {
+    protected:
+        struct Device {
+            uint8_t     address = 0;
+            uint8_t *   memory = nullptr;
+            size_t      size = 0;
+            size_t      pointer = 0;
+        };
+
+        Device      devices[HOST_WIRE_DEVICES];
+        bool        enabled = false;
+
+        uint8_t     txAddress = 0;
+        uint8_t     txBuffer[BUFFER_LENGTH];
+        size_t      txLen = 0;
+        bool        txOverflow = false;
+
+        uint8_t     rxBuffer[BUFFER_LENGTH];
+        size_t      rxLen = 0;
+        size_t      rxPos = 0;
+
+        Device * find(const uint8_t address) {
+            for (size_t i = 0; i < HOST_WIRE_DEVICES; i++)
+                if (devices[i].memory != nullptr && devices[i].address == address) return &devices[i];
+            return nullptr;
+        }
+
+    public:
+        unsigned long transactions = 0;     // bus transactions started, for tests
+
+        void begin() { enabled = true; }
+        void begin(uint8_t address) { (void)address; enabled = true; }
+        void end() { enabled = false; }
+        void setClock(uint32_t clock) { (void)clock; }
+
+        // Put a device with 'size' bytes of 'memory' on the bus at 'address' (nullptr removes it)
+        void hostDevice(const uint8_t address, uint8_t * memory, const size_t size) {
+            Device * d = find(address);
+            if (memory == nullptr || size == 0) { if (d != nullptr) *d = Device(); return; }
+
+            for (size_t i = 0; i < HOST_WIRE_DEVICES && d == nullptr; i++)
+                if (devices[i].memory == nullptr) d = &devices[i];
+            if (d == nullptr) return;
+
+            d->address = address;
+            d->memory = memory;
+            d->size = size;
+            d->pointer = 0;
+        }
+
+        void beginTransmission(uint8_t address) {
+            txAddress = address;
+            txLen = 0;
+            txOverflow = false;
+        }
+
+        // 0 sent, 1 too long for the buffer, 2 address NACK, 4 bus not started
+        uint8_t endTransmission(uint8_t sendStop = true) {
+            (void)sendStop;
+            if (!enabled) return 4;
+            if (txOverflow) return 1;
+            transactions++;
+
+            Device * d = find(txAddress);
+            if (d == nullptr) return 2;
+
+            for (size_t i = 0; i < txLen; i++) {
+                if (i == 0) d->pointer = txBuffer[0] % d->size;
+                else        { d->memory[d->pointer] = txBuffer[i]; d->pointer = (d->pointer + 1) % d->size; }
+            }
+            return 0;
+        }
+
+        uint8_t requestFrom(uint8_t address, uint8_t quantity, uint8_t sendStop = true) {
+            (void)sendStop;
+            rxLen = rxPos = 0;
+            if (!enabled || quantity > BUFFER_LENGTH) return 0;
+            transactions++;
+
+            Device * d = find(address);
+            if (d == nullptr) return 0;
+
+            for (; rxLen < quantity; rxLen++) {
+                rxBuffer[rxLen] = d->memory[d->pointer];
+                d->pointer = (d->pointer + 1) % d->size;
+            }
+            return rxLen;
+        }
+
+        int available() override { return int(rxLen - rxPos); }
+        int read() override { return rxPos < rxLen ? rxBuffer[rxPos++] : -1; }
+        int peek() override { return rxPos < rxLen ? rxBuffer[rxPos] : -1; }
+
+        size_t write(uint8_t b) override {
+            if (txLen == BUFFER_LENGTH) { txOverflow = true; return 0; }
+            txBuffer[txLen++] = b;
+            return 1;
+        }
+        using Print::write;
+};
+
+extern TwoWire Wire;
+
+#endif // HOST_WIRE_H
@@ -0,0 +1,30 @@
+/*
+    main.cpp - Runs the sketch as a Linux process
+
+    Serial is a pseudo-terminal; point any Modbus RTU master at the path printed on startup.
+*/
+
+#include <Arduino.h>
+#include <stdio.h>
+#include "FdStream.h"
+
+void setup();
+void loop();
+
+int main() {
+    PtyStream pty;
+    if (!pty.open()) {
+        perror("modmata-peripheral: can't open a pty");
+        return 1;
+    }
+
+    fprintf(stderr, "modmata-peripheral: serial port is %s\n", pty.peerName());
+    Serial.attach(pty);
+
+    setup();
+    for (;;) {
+        loop();
+        // Sleep while the line is idle, but wake often enough to see t3.5 of silence promptly
+        pty.waitReadable(250);
+    }
+}
@@ -0,0 +1,2 @@
+// The sketch itself, compiled as an ordinary C++ file for the host build
+#include "../modmata-peripheral.ino"
@@ -0,0 +1,28 @@
+/*
+    tcp_main.cpp - Serves a register table over Modbus TCP as a Linux process
+
+    Usage: modmata-tcp [port]   (default 5020; 502 needs root)
+*/
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "TcpServer.h"
+
+TcpModmata peripheral;
+
+int main(int argc, char ** argv) {
+    const uint16_t port = argc > 1 ? uint16_t(atoi(argv[1])) : 5020;
+
+    TcpServer server(peripheral);
+    if (!server.begin(port)) {
+        perror("modmata-tcp: can't listen");
+        return 1;
+    }
+
+    fprintf(stderr, "modmata-tcp: listening on port %u\n", server.port());
+    while (server.poll(-1)) {}
+
+    perror("modmata-tcp: epoll_wait");
+    return 1;
+}
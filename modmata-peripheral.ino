@@ -1,22 +1,23 @@
 #include "ModbusSerial.h"
+#include "scheduler.h"
 
-Packet packet(255);
-ModmataPeripheral mp;
+SerialModmata sm(Serial, 9600, SERIAL_8N1);
+Scheduler scheduler;
+
+// rxADU() doesn't wait, so the bus task returns at once between frames and the other tasks keep
+// their deadlines
+static void serviceBus(void *) { sm.task(); }
 
 void setup() {
-    mp = ModmataPeripheral();
-    packet.adu.setAddr(0x11);
-    
-    //sm.setID(0x11);        
+    Serial.begin(9600, SERIAL_8N1);
+    sm.setID(0x11);
 //    pinMode(13, OUTPUT);
+//    sm.holdings.setRegister(0, 1234);     // each space is addressed as on the wire: this is 40001
+
+    scheduler.add(serviceBus, 0);
+    // scheduler.add(controlLoop, 1000, 10);   // e.g. a 1 ms control task, ahead of the bus
 }
 
 void loop() {
-
-//    const RX_STATE state = sm.rxADU();
-//    if (state == STATE_NORMAL) {
-//        sm.execute();
-//        digitalWrite(13, sm.ReadCoil(1).DATA[2]);
-//    }
-    
+    scheduler.poll(micros());
 }
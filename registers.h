@@ -1,67 +1,338 @@
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifndef REGISTERS_H
 #define REGISTERS_H
 
 // Struct to represent any kind of modbus register in memory
-typedef struct Register {
+struct Register {
     uint16_t address;
     uint16_t value;
 };
 
-// Comparator function for binary searching
-static int _bsearch_addr_comparator(const void * addr, const void * reg) {
-    return int(*(const uint16_t *)addr) - int((*(const Register **)reg)->address);
-    // ( addr < reg.addr : ret -n)
-    // ( addr > reg.addr : ret +n )
-    // ( addr !< or !> reg.addr: ret 0)
-}
-
 // Comparator function for qsort
 static int _qsort_addr_comparator(const void * reg0, const void * reg1) {
-    return int((*(const Register **)reg0)->address) - int((*(const Register **)reg1)->address);
+    return int(((const Register *)reg0)->address) - int(((const Register *)reg1)->address);
     // ( reg0->addr < reg1->addr : ret -n)
     // ( reg0->addr > reg1->addr : ret +n )
     // ( reg0->addr !< or !> reg1.addr: ret 0)
 }
 
-// Helper function for calloc() calls
-static Register ** _genTableOfLen(const uint16_t len) {
-    return (Register **)calloc(size_t(len), sizeof(Register*));
+// Helper function for (re)allocating the contiguous register storage
+static Register * _growTableTo(Register * table, const size_t capacity) {
+    return (Register *)realloc(table, capacity * sizeof(Register));
+}
+
+static const bool validRegister(const Register * ref) {
+    return ref != NULL;
+}
+
+// Change bits, one pair per register slot or block (see RegisterArray::readChanged())
+#define CHANGED_NOW         0x01    // changed in the current epoch
+#define CHANGED_BEFORE      0x02    // changed in the epochs before it, back to the acknowledged one
+#define CHANGED_ANY         0xFF    // not a bit: the question reaches back past them
+
+static const bool _bit(const uint8_t * bits, const size_t i) { return (bits[i >> 3] >> (i & 7)) & 1u; }
+
+static const void _setBit(uint8_t * bits, const size_t i, const bool on) {
+    if (on) bits[i >> 3] |= uint8_t(1u << (i & 7));
+    else    bits[i >> 3] &= uint8_t(~(1u << (i & 7)));
+}
+
+// Make room for bit 'index' of a bitmap holding 'size' bits, moving the ones above it up
+static const void _insertBit(uint8_t * bits, const size_t index, const size_t size) {
+    for (size_t i = size; i > index; i--) _setBit(bits, i, _bit(bits, i - 1));
+    _setBit(bits, index, false);
+}
+
+// Drop bit 'index' of a bitmap holding 'size' bits, moving the ones above it down
+static const void _eraseBit(uint8_t * bits, const size_t index, const size_t size) {
+    for (size_t i = index; i + 1 < size; i++) _setBit(bits, i, _bit(bits, i + 1));
+    _setBit(bits, size - 1, false);
+}
+
+// Helper function for growing a bitmap of 'from' bits to 'capacity' bits, the new ones clear
+static const bool _growBitsTo(uint8_t *& bits, const size_t from, const size_t capacity) {
+    const size_t had = (from + 7) / 8;
+    const size_t need = (capacity + 7) / 8;
+    if (need <= had) return true;
+
+    uint8_t * grown = (uint8_t *)realloc(bits, need);
+    if (grown == NULL) return false;
+    memset(grown + had, 0, need - had);
+    bits = grown;
+    return true;
+}
+
+// Dense run of registers [first, first+count) whose values live in caller-provided (usually static)
+// storage, so resolving an address is a subtraction rather than a search. See regmap.h.
+struct RegisterBlock {
+    uint16_t first;
+    uint16_t count;
+    uint16_t * values;
+    RegisterBlock * next;
+    uint8_t changed;    // CHANGED_NOW/CHANGED_BEFORE for any change anywhere in the block
+
+    const bool contains(const uint16_t address) const { return uint16_t(address - first) < count; }
+};
+
+// Callbacks behind a RegisterBinding. 'key' is the binding's key plus the offset into its range
+// (e.g. a pin number), 'value' is the register value, or 0/1 for coils.
+typedef uint16_t (*BindingRead)(const uint16_t key);
+typedef bool (*BindingWrite)(const uint16_t key, const uint16_t value);
+
+// Run of addresses [first, first+count) that holds no value of its own: reading calls 'read' and
+// writing calls 'write' at request time (a missing callback reads as 0 / refuses the write).
+// Bindings are checked before attached blocks and the table. See BoundRange in regmap.h.
+struct RegisterBinding {
+    uint16_t first;
+    uint16_t count;
+    uint16_t key;
+    BindingRead read;
+    BindingWrite write;
+    RegisterBinding * next;
+
+    const bool contains(const uint16_t address) const { return uint16_t(address - first) < count; }
+    const uint16_t get(const uint16_t address) const { return read != nullptr ? read(key + (address - first)) : 0u; }
+    const bool put(const uint16_t address, const uint16_t value) const {
+        return write != nullptr && write(key + (address - first), value);
+    }
+};
+
+// First binding in 'list' that covers 'address'
+static const RegisterBinding * _bindingFor(const RegisterBinding * list, const uint16_t address) {
+    for (const RegisterBinding * b = list; b != nullptr; b = b->next)
+        if (b->contains(address)) return b;
+    return nullptr;
 }
 
-static Register * _allocateRegister(uint16_t address=0, uint16_t value=0) {
-    Register * _temp = (Register*)malloc(sizeof(Register));
-    _temp->address = address;
-    _temp->value = value;
-    return _temp;
+// Number of addresses from 'address' up to the first binding in 'list' after it (or the end of the space)
+static const uint32_t _runBeforeBinding(const RegisterBinding * list, const uint16_t address) {
+    uint32_t run = 0x10000ul - address;
+    for (const RegisterBinding * b = list; b != nullptr; b = b->next)
+        if (b->first > address && uint32_t(b->first - address) < run) run = b->first - address;
+    return run;
 }
 
-static const bool validRegister(const Register ** ref) {
-    return ref != NULL && *ref != NULL;
+// Whether any of the 'count' addresses from 'address' is bound in 'list'
+static const bool _rangeBound(const RegisterBinding * list, const uint16_t address, const uint16_t count) {
+    return _bindingFor(list, address) != nullptr || _runBeforeBinding(list, address) < count;
 }
 
+// Told whenever stored values of a RegisterArray or BitBank change: the 'count' addresses from
+// 'address' (protocol addresses, or bit numbers) may read differently from now on. See observe().
+typedef void (*WriteObserver)(void * context, const uint16_t address, const uint16_t count);
+
 // Container type to store modbus registers and allow (simulated) "random" indexed access
 // (using binary search so not log(1) but the best we have in this situation, log2(n))
 class RegisterArray {
     protected:
-        // lookupTable: list of Register pointers ( no stl :c )
-        // sizeof(Register) = 4 bytes
-        // sizeof(Register*) = 2 bytes
-        // On AMD64: sizeof(Register*) = 8 bytes
-        Register ** lookupTable = nullptr;
+        // lookupTable: one contiguous block of Registers kept sorted by address ( no stl :c )
+        // sizeof(Register) = 4 bytes, so a bsearch hit is the register itself, no pointer chase
+        // Capacity doubles when full, so provisioning n registers costs O(log n) reallocs
+        // instead of one calloc + one malloc + one qsort per register
+        Register * lookupTable = nullptr;
         size_t tableSize = 0;
-        
+        size_t tableCapacity = 0;
+
+        // Statically allocated blocks attached with attach(), checked before the sorted table
+        RegisterBlock * blocks = nullptr;
+
+        // Callback ranges added with bind(), checked before everything else
+        RegisterBinding * bindings = nullptr;
+
+        // Change tracking (see readChanged()): a count of every change, and two bits per table slot,
+        // parallel to lookupTable, for the registers changed after epochSeq and from lastEpochSeq to it
+        uint32_t changeSeq = 0;
+        uint32_t epochSeq = 0;
+        uint32_t lastEpochSeq = 0;
+        uint8_t * changedNow = nullptr;
+        uint8_t * changedBefore = nullptr;
+
+        WriteObserver observer = nullptr;
+        void * observerContext = nullptr;
+
+        const void notify(const uint16_t address, const uint16_t count = 1) const {
+            if (observer != nullptr) observer(observerContext, address, count);
+        }
+
+        RegisterBlock * blockFor(const uint16_t address) const {
+            for (RegisterBlock * b = blocks; b != nullptr; b = b->next)
+                if (b->contains(address)) return b;
+            return nullptr;
+        }
+
+        // Number of addresses from 'address' up to the next attached block or binding (or the end of the space)
+        const uint32_t runBeforeBlock(const uint16_t address) const {
+            uint32_t run = _runBeforeBinding(bindings, address);
+            for (const RegisterBlock * b = blocks; b != nullptr; b = b->next)
+                if (b->first > address && uint32_t(b->first - address) < run) run = b->first - address;
+            return run;
+        }
+
+        // Index of the first register whose address is >= 'address' (tableSize if none)
+        const size_t lowerBound(const uint16_t address) const {
+            // Fast path for in-order provisioning: appending past the last register
+            if (tableSize == 0 || lookupTable[tableSize-1].address < address) return tableSize;
+
+            size_t lo = 0, hi = tableSize;
+            while (lo < hi) {
+                const size_t mid = lo + ((hi - lo) >> 1);
+                if (lookupTable[mid].address < address) lo = mid + 1;
+                else hi = mid;
+            }
+            return lo;
+        }
+
+        const bool growTable() {
+            const size_t capacity = tableCapacity ? tableCapacity * 2 : 4;
+            return reserve(capacity);
+        }
+
+        Register * insertAt(const size_t index, const uint16_t address, const uint16_t value) {
+            if (tableSize == tableCapacity && !growTable()) return nullptr;
+
+            // Shift the tail up by one slot (no-op when appending in order)
+            memmove(lookupTable + index + 1, lookupTable + index, sizeof(Register) * (tableSize - index));
+            _insertBit(changedNow, index, tableSize);
+            _insertBit(changedBefore, index, tableSize);
+            lookupTable[index].address = address;
+            lookupTable[index].value = value;
+            tableSize++;
+            markChanged(index);
+            notify(address);
+            return lookupTable + index;
+        }
+
+        // readRange/writeRange over the sorted table only (no attached blocks inside the run)
+        const uint16_t readSorted(const uint16_t address, const uint16_t count, uint8_t * out) const {
+            const Register * r = firstAtOrAfter(address);
+            const Register * last = end();
+            uint16_t gaps = 0;
+
+            for (uint16_t i = 0; i < count; i++) {
+                const uint16_t a = address + i;
+                uint16_t wrd = 0u;
+
+                if (r < last && r->address == a) { wrd = r->value; r++; }
+                else gaps++;
+
+                out[   i*2   ] = highByte(wrd);
+                out[ (i*2)+1 ] = lowByte(wrd);
+            }
+
+            return gaps;
+        }
+
+        // Count a change to the register in table slot 'index' (or to block 'b')
+        const void markChanged(const size_t index) {
+            _setBit(changedNow, index, true);
+            changeSeq++;
+        }
+
+        const void markChanged(RegisterBlock& b) {
+            b.changed |= CHANGED_NOW;
+            changeSeq++;
+        }
+
+        // Start a new epoch at the latest change. The current one joins the epoch before it, or
+        // replaces it when 'acknowledged' (the controller has seen everything up to its start).
+        const void newEpoch(const bool acknowledged) {
+            for (size_t i = 0; i < (tableCapacity + 7) / 8; i++) {
+                changedBefore[i] = acknowledged ? changedNow[i] : uint8_t(changedBefore[i] | changedNow[i]);
+                changedNow[i] = 0;
+            }
+            for (RegisterBlock * b = blocks; b != nullptr; b = b->next) {
+                const uint8_t before = acknowledged ? 0 : (b->changed & CHANGED_BEFORE);
+                b->changed = before | ((b->changed & CHANGED_NOW) ? CHANGED_BEFORE : 0);
+            }
+            if (acknowledged) lastEpochSeq = epochSeq;
+            epochSeq = changeSeq;
+        }
+
+        // Store a value, marking the register (or block) if it actually changed
+        const void setValue(Register& r, const uint16_t value) {
+            if (r.value == value) return;
+            r.value = value;
+            markChanged(&r - lookupTable);
+            notify(r.address);
+        }
+
+        const void setBlockValue(RegisterBlock& b, const uint16_t address, const uint16_t value) {
+            uint16_t& v = b.values[address - b.first];
+            if (v == value) return;
+            v = value;
+            markChanged(b);
+            notify(address);
+        }
+
+        const bool writeSorted(const uint16_t address, const uint16_t count, const uint8_t * in, uint16_t& created) {
+            size_t index = lowerBound(address);
+
+            for (uint16_t i = 0; i < count; i++, index++) {
+                const uint16_t a = address + i;
+                const uint16_t wrd = makeWord(in[i*2], in[(i*2)+1]);
+
+                if (index < tableSize && lookupTable[index].address == a) setValue(lookupTable[index], wrd);
+                else if (insertAt(index, a, wrd) != nullptr) created++;
+                else return false;
+            }
+
+            return true;
+        }
+
     public:
         RegisterArray() {}
+        ~RegisterArray() {
+            free(lookupTable);
+            free(changedNow);
+            free(changedBefore);
+            lookupTable = nullptr;
+            changedNow = changedBefore = nullptr;
+            tableSize = tableCapacity = 0;
+        }
+
+        const RegisterArray& operator= (const RegisterArray& assign) {
+            if (this != &assign) {
+                blocks = assign.blocks;     // blocks are static storage, so they're shared not copied
+                bindings = assign.bindings;
+                changeSeq = assign.changeSeq;
+                epochSeq = assign.epochSeq;
+                lastEpochSeq = assign.lastEpochSeq;
+                tableSize = 0;
+                if (reserve(assign.tableSize)) {
+                    memcpy(lookupTable, assign.lookupTable, sizeof(Register) * assign.tableSize);
+                    if (assign.tableSize > 0) {
+                        memcpy(changedNow, assign.changedNow, (assign.tableSize + 7) / 8);
+                        memcpy(changedBefore, assign.changedBefore, (assign.tableSize + 7) / 8);
+                    }
+                    tableSize = assign.tableSize;
+                }
+                notify(0, 0xFFFF);
+            }
+
+            return *this;
+        }
+
+        RegisterArray(const RegisterArray& copy) { *this = copy; }
+
+        // Preallocate room for 'capacity' registers in a single allocation
+        const bool reserve(const size_t capacity) {
+            if (capacity <= tableCapacity) return true;
+            Register * grownTable = _growTableTo(lookupTable, capacity);
+            if (grownTable == NULL) return false;
+            lookupTable = grownTable;
+            if (!_growBitsTo(changedNow, tableCapacity, capacity)) return false;
+            if (!_growBitsTo(changedBefore, tableCapacity, capacity)) return false;
+            tableCapacity = capacity;
+            return true;
+        }
 
-        Register ** getRegisterPtr(const uint16_t address) const {
-            return static_cast<Register **>(bsearch(
-                static_cast<const void *>(&address),
-                static_cast<const void *>(lookupTable),
-                tableSize, sizeof(Register*), _bsearch_addr_comparator
-            ));
+        Register * getRegisterPtr(const uint16_t address) const {
+            const size_t index = lowerBound(address);
+            if (index < tableSize && lookupTable[index].address == address) return lookupTable + index;
+            return nullptr;
         }
 
         const signed int getRegisterIndex(const uint16_t address) const {
@@ -71,121 +342,314 @@ class RegisterArray {
 
             signed int offset {-1}; // index of -1 == register DNE
             
-            const Register ** ref = static_cast<Register **>(bsearch(
-                static_cast<const void *>(&address),
-                static_cast<const void *>(lookupTable),
-                tableSize, sizeof(Register*), _bsearch_addr_comparator
-            ));
+            const Register * ref = getRegisterPtr(address);
 
             if (validRegister(ref)) {
                 // Pointer arithmetic:
                 // since (member_adddress >= base_address),
                 // [num of bytes before member aka:] relative_offset_of_member = member_address - base_address
                 // relative_offset / sizeof(member)
-                offset = (Register**)ref - lookupTable;
+                offset = ref - lookupTable;
             }
 
             return offset;
         }
 
+        // Pointer to the value held at 'address', whether it lives in an attached block or the table
+        uint16_t * valuePtr(const uint16_t address) const {
+            const RegisterBlock * b = blockFor(address);
+            if (b != nullptr) return b->values + (address - b->first);
+
+            Register * r = getRegisterPtr(address);
+            return validRegister(r) ? &r->value : nullptr;
+        }
+
         const uint16_t getRegisterVal(const uint16_t address) const {
-            if (this->registerExists(address)) return (**getRegisterPtr(address)).value;
-            else return 0u;
+            const RegisterBinding * bound = _bindingFor(bindings, address);
+            if (bound != nullptr) return bound->get(address);
+
+            const uint16_t * v = valuePtr(address);
+            return v != nullptr ? *v : 0u;
         }
 
         const bool registerExists(const uint16_t address) const {
-            return getRegisterIndex(address) >= 0 ? true : false;
+            return _bindingFor(bindings, address) != nullptr || valuePtr(address) != nullptr;
         }
 
         const void setRegister(const uint16_t address, const uint16_t value) {
-            Register ** _temp = getRegisterPtr(address);
-            if (validRegister(_temp)) (**_temp).value = value;
-            else addRegister(address, value);
+            this->verifySetRegister(address, value);
         }
 
         const bool verifySetRegister(const uint16_t address, const uint16_t value) {
-            this->setRegister(address, value);
-            const Register ** r = this->getRegisterPtr(address);
-            if (validRegister(r)) return (**r).value == value;
-            else return false;
+            const RegisterBinding * bound = _bindingFor(bindings, address);
+            if (bound != nullptr) return bound->put(address, value);
+
+            RegisterBlock * b = blockFor(address);
+            if (b != nullptr) { setBlockValue(*b, address, value); return true; }
+
+            const size_t index = lowerBound(address);
+            Register * r = nullptr;
+            if (index < tableSize && lookupTable[index].address == address) r = lookupTable + index;
+            else r = insertAt(index, address, value);
+
+            if (!validRegister(r)) return false;
+            setValue(*r, value);
+            return r->value == value;
         }
 
-        const void sort() {
-            // Sort using the AVR libc qsort
-            if (lookupTable != nullptr && tableSize > 1)
-                qsort(lookupTable, tableSize, sizeof(Register*), _qsort_addr_comparator);
+        // Add a dense block of registers; its addresses are served from the block from now on
+        const void attach(RegisterBlock& block) {
+            block.next = blocks;
+            block.changed = 0;
+            markChanged(block);
+            blocks = &block;
+            notify(block.first, block.count);
         }
 
-        const void swapByAddr(const uint16_t address0, const uint16_t address1) {
-            // Swap values of registers at address0 and address1
-            Register ** ptr0 = getRegisterPtr(address0);
-            Register ** ptr1 = getRegisterPtr(address1);
-            if (ptr0 != nullptr && ptr1 != nullptr) {
-                // I am so fucking sorry for using XOR swap
-                (*ptr0)->value ^= (*ptr1)->value ^= (*ptr0)->value ^= (*ptr1)->value;
-            }
+        // Resolve 'binding's addresses through its callbacks from now on
+        const void bind(RegisterBinding& binding) {
+            binding.next = bindings;
+            bindings = &binding;
+            notify(binding.first, binding.count);
         }
 
-        const void addRegister(const uint16_t address, const uint16_t initial_value=0) {
-            // Allocate space
-            Register ** grownTable = _genTableOfLen(tableSize + 1);
-            
-            if (lookupTable == NULL) { // add new register to empty table
-                lookupTable = grownTable;
-                lookupTable[0] = _allocateRegister(address, initial_value);
-                tableSize++;
-            }   // Trivially sorted
-
-            else {  
-                // If the 'old' table was non-empty, copy data & delete old stuff, reassign ptr
-                memcpy(grownTable, lookupTable, sizeof(Register*) * (tableSize + 1));
-                free(lookupTable);
-                lookupTable = grownTable;
-
-                // Populate data of empty register at the end of array
-                lookupTable[tableSize] = _allocateRegister(address, initial_value);
-                tableSize++;
-                this->sort();
+        // Whether any of the 'count' addresses from 'address' is bound (read through a callback)
+        const bool bound(const uint16_t address, const uint16_t count) const { return _rangeBound(bindings, address, count); }
+
+        // Call 'observer(context, ...)' on every change to a stored value, from the same places that
+        // count them (see below), plus deletions and new blocks or bindings. One observer per table.
+        const void observe(WriteObserver observer, void * context) {
+            this->observer = observer;
+            this->observerContext = context;
+        }
+
+        // Change tracking
+        //
+        // Every stored value that changes (or is created, or deleted) through this class takes the
+        // next change number; changes() is the latest. Values changed behind its back, e.g. through
+        // valuePtr() or a StaticRegisterMap's storage, need a touch(). Bound addresses aren't stored,
+        // so they're never reported.
+
+        const uint32_t changes() const { return changeSeq; }
+
+        // Mark 'address' as changed now
+        const void touch(const uint16_t address) {
+            notify(address);
+
+            RegisterBlock * b = blockFor(address);
+            if (b != nullptr) { markChanged(*b); return; }
+
+            const signed int index = getRegisterIndex(address);
+            if (index != -1) markChanged(index);
+        }
+
+        // Write the registers in [from, to) that changed after change number 'since' to 'out' in
+        // address order, as big-endian (address, value) pairs, at most 'max' of them. Returns how many;
+        // 'resume' is where to carry on from, or 'to' once the range is done.
+        //
+        // Rather than a change number per register, the table keeps one bit per register for the
+        // current epoch of changes (since the last call) and one for the epochs before it, back to
+        // the 'since' a controller last acknowledged. Every call starts a new epoch; a 'since' at or
+        // after the current epoch's start acknowledges the ones before. So a controller passing the
+        // number from its previous reply gets exactly what changed after it, and so does one
+        // repeating a request whose reply was lost. Any other 'since' back to the acknowledged one
+        // gets a few more, and an older one (or one from the future, after a reset) gets everything.
+        // Blocks are marked as a whole, so a change to one of its registers reports all of them.
+        const uint16_t readChanged(const uint32_t since, const uint16_t from, const uint16_t to,
+                                   uint8_t * out, const uint16_t max, uint32_t& resume) {
+            const bool known = since >= lastEpochSeq && since <= changeSeq;
+            if (known) newEpoch(since >= epochSeq);
+
+            // After the new epoch, everything after 'since' is in the epoch before
+            uint8_t scope = CHANGED_ANY;
+            if (since == changeSeq) scope = 0;
+            else if (known)         scope = CHANGED_BEFORE;
+
+            const Register * r = firstAtOrAfter(from);
+            const Register * last = end();
+            uint32_t a = scope != 0 ? from : to;
+            uint16_t n = 0;
+
+            while (a < to) {
+                // Next changed register in the table, skipping what blocks and bindings shadow
+                while (r < last && r->address < to
+                       && (r->address < a || !(scope == CHANGED_ANY || _bit(changedBefore, r - lookupTable))
+                           || blockFor(r->address) != nullptr || _bindingFor(bindings, r->address) != nullptr))
+                    r++;
+                uint32_t next = (r < last && r->address < to) ? r->address : to;
+                uint16_t value = next < to ? r->value : 0;
+
+                // ... or in a changed block, if one comes first
+                for (const RegisterBlock * b = blocks; b != nullptr; b = b->next) {
+                    if ((scope != CHANGED_ANY && !(b->changed & CHANGED_BEFORE)) || uint32_t(b->first) + b->count <= a) continue;
+                    uint32_t c = b->first > a ? b->first : a;
+                    while (c < uint32_t(b->first) + b->count && _bindingFor(bindings, c) != nullptr) c++;
+                    if (c < next && c < uint32_t(b->first) + b->count) { next = c; value = b->values[c - b->first]; }
+                }
+
+                if (next >= to) { a = to; break; }
+                if (n == max) { a = next; break; }
+
+                out[n*4]     = highByte(uint16_t(next));
+                out[n*4 + 1] = lowByte(uint16_t(next));
+                out[n*4 + 2] = highByte(value);
+                out[n*4 + 3] = lowByte(value);
+                n++;
+                a = next + 1;
             }
+
+            resume = a;
+            return n;
         }
 
-        const void delRegister(const uint16_t address) {
-            if (!validRegister(lookupTable)) return;        // Empty lookup table
+        // First register with an address >= 'address' (end() if there is none)
+        const Register * firstAtOrAfter(const uint16_t address) const { return lookupTable + lowerBound(address); }
+        const Register * end() const { return lookupTable + tableSize; }
+
+        // Copy 'count' consecutive registers starting at 'address' into 'out' as big-endian words
+        // (Modbus wire order). Bindings are read through their callbacks, attached blocks are copied
+        // by offset; for the sorted table one search finds the start, then the run is walked linearly.
+        // Addresses with no register read as 0; returns how many of those gaps there were.
+        const uint16_t readRange(const uint16_t address, const uint16_t count, uint8_t * out) const {
+            uint16_t gaps = 0;
+
+            for (uint16_t i = 0; i < count; ) {
+                const uint16_t a = address + i;
+                const RegisterBinding * bound = _bindingFor(bindings, a);
+                const RegisterBlock * b = bound == nullptr ? blockFor(a) : nullptr;
+                uint16_t n = count - i;
+
+                if (bound != nullptr) {
+                    if (uint32_t(bound->first) + bound->count - a < n) n = bound->first + bound->count - a;
+                    for (uint16_t j = 0; j < n; j++) {
+                        const uint16_t v = bound->get(a + j);
+                        out[ (i+j)*2     ] = highByte(v);
+                        out[ (i+j)*2 + 1 ] = lowByte(v);
+                    }
+                }
+
+                else if (b != nullptr) {
+                    if (uint32_t(b->first) + b->count - a < n) n = b->first + b->count - a;
+                    if (_runBeforeBinding(bindings, a) < n) n = _runBeforeBinding(bindings, a);
+                    const uint16_t * v = b->values + (a - b->first);
+                    for (uint16_t j = 0; j < n; j++) {
+                        out[ (i+j)*2     ] = highByte(v[j]);
+                        out[ (i+j)*2 + 1 ] = lowByte(v[j]);
+                    }
+                }
+
+                else {
+                    if (runBeforeBlock(a) < n) n = runBeforeBlock(a);
+                    gaps += readSorted(a, n, out + i*2);
+                }
+
+                i += n;
+            }
 
-            signed int index = getRegisterIndex(address);   
-            if (index == -1) return;                        // Register not found
+            return gaps;
+        }
 
-            bool high =     (index != 0 && index == tableSize);
-            bool low =      (index == 0 && tableSize > 0);
-            bool onePartition = (high || low);
-            bool twoPartition = (tableSize > 0 && !(high || low));
+        // Apply 'count' big-endian words from 'in' to consecutive registers starting at 'address'.
+        // Missing registers are created in place (same as setRegister); 'gaps' receives how many.
+        // Returns false if the table could not grow to hold them, or a binding refused its value.
+        const bool writeRange(const uint16_t address, const uint16_t count, const uint8_t * in, uint16_t * gaps=nullptr) {
+            uint16_t created = 0;
+            bool ok = true;
+
+            for (uint16_t i = 0; i < count && ok; ) {
+                const uint16_t a = address + i;
+                const RegisterBinding * bound = _bindingFor(bindings, a);
+                RegisterBlock * b = bound == nullptr ? blockFor(a) : nullptr;
+                uint16_t n = count - i;
+
+                if (bound != nullptr) {
+                    if (uint32_t(bound->first) + bound->count - a < n) n = bound->first + bound->count - a;
+                    for (uint16_t j = 0; j < n && ok; j++) ok = bound->put(a + j, makeWord(in[(i+j)*2], in[(i+j)*2 + 1]));
+                }
+
+                else if (b != nullptr) {
+                    if (uint32_t(b->first) + b->count - a < n) n = b->first + b->count - a;
+                    if (_runBeforeBinding(bindings, a) < n) n = _runBeforeBinding(bindings, a);
+                    for (uint16_t j = 0; j < n; j++) setBlockValue(*b, a + j, makeWord(in[(i+j)*2], in[(i+j)*2 + 1]));
+                }
+
+                else {
+                    if (runBeforeBlock(a) < n) n = runBeforeBlock(a);
+                    ok = writeSorted(a, n, in + i*2, created);
+                }
+
+                i += n;
+            }
 
-            Register ** shrunkTable = _genTableOfLen(tableSize-1);
+            if (gaps) *gaps = created;
+            return ok;
+        }
 
-            if (onePartition) { // One partition, just shrunk by 1 since we can just copy everything else contiguously 
-                memcpy(shrunkTable, lookupTable + (low ? 1 : 0),    sizeof(Register *) * (tableSize-1));
+        const void sort() {
+            // Insertion keeps the table sorted; this only matters if someone wrote through exposeTable()
+            if (lookupTable != nullptr && tableSize > 1) {
+                qsort(lookupTable, tableSize, sizeof(Register), _qsort_addr_comparator);
+
+                // The change bits no longer line up with their registers: count them all as changed
+                memset(changedNow, 0xFF, tableSize / 8);
+                for (size_t i = tableSize & ~size_t(7); i < tableSize; i++) _setBit(changedNow, i, true);
+                changeSeq++;
             }
+        }
 
-            else if (twoPartition) {  // Two sections to copy for anything not at the edges
-                memcpy(shrunkTable,         lookupTable,                sizeof(Register *) * (index));
-                memcpy(shrunkTable+index,   lookupTable + (index+1),    sizeof(Register *) * (tableSize-index-1));
+        const void swapByAddr(const uint16_t address0, const uint16_t address1) {
+            // Swap values of registers at address0 and address1
+            const uint16_t * ptr0 = valuePtr(address0);
+            const uint16_t * ptr1 = valuePtr(address1);
+            if (ptr0 != nullptr && ptr1 != nullptr && ptr0 != ptr1) {
+                // Through verifySetRegister so both count as changes
+                const uint16_t v0 = *ptr0, v1 = *ptr1;
+                verifySetRegister(address0, v1);
+                verifySetRegister(address1, v0);
             }
+        }
+
+        const void addRegister(const uint16_t address, const uint16_t initial_value=0) {
+            // Sorted insertion in place; an existing register just takes the new value
+            this->setRegister(address, initial_value);
+        }
 
-            free(lookupTable[index]);   // deallocate register since we used double ptrs
-            free(lookupTable);          // deallocate old table
-            lookupTable = shrunkTable;
+        const void delRegister(const uint16_t address) {
+            signed int index = getRegisterIndex(address);   
+            if (index == -1) return;                        // Register not found (or empty table)
+
+            // Close the gap; capacity is kept so re-adding doesn't hit the allocator
+            memmove(lookupTable + index, lookupTable + index + 1, sizeof(Register) * (tableSize - index - 1));
+            _eraseBit(changedNow, index, tableSize);
+            _eraseBit(changedBefore, index, tableSize);
             tableSize--;
+
+            // A change (the address reads as 0 now) though there's no register left to report
+            changeSeq++;
+            notify(address);
             // no need to sort elements that have not changed order relative to deleted register
         }
 
+        const size_t size() const { return tableSize; }
+        const size_t capacity() const { return tableCapacity; }
+
         #ifdef EXPOSE_TESTS
-        Register ** exposeTable() { return lookupTable; }
+        Register * exposeTable() { return lookupTable; }
         const size_t exposeTableSize() { return tableSize; }
         #endif
 
         const void printRegisters() const {
-            for (int i = 0; i < tableSize; i++) {
-                Register r = *lookupTable[i];
+            for (const RegisterBlock * b = blocks; b != nullptr; b = b->next) {
+                for (uint16_t i = 0; i < b->count; i++) {
+                    Serial.print("Address: ");
+                    Serial.print(b->first + i);
+                    Serial.print(" Value: ");
+                    Serial.println(b->values[i], HEX);
+                }
+            }
+
+            for (size_t i = 0; i < tableSize; i++) {
+                Register r = lookupTable[i];
                 Serial.print("Address: ");
                 Serial.print(r.address);
                 Serial.print(" Value: ");
@@ -202,7 +666,7 @@ const void test() {
     RegisterArray table;
 
     // Insert in reverse order to an empty table
-    // Uses: _genTableOfLen, _allocateRegister, sort, _qsort_addr_comparator
+    // Uses: _growTableTo, reserve, lowerBound, insertAt
     table.addRegister(5,5);
     table.addRegister(4,4);
     table.addRegister(3,3);
@@ -218,7 +682,7 @@ const void test() {
 
 
     // Swap values
-    // Uses: swapByAddr, _bsearch_addr_comparator
+    // Uses: swapByAddr, lowerBound
     table.swapByAddr(1, 5);
     table.swapByAddr(2, 4);
 
@@ -226,19 +690,17 @@ const void test() {
     // Uses: getRegisterIndex, delRegister, getRegisterVal
     for (unsigned int i=0; i < 5; i++) {
         for (unsigned int j=0; j < table.exposeTableSize(); j++) {
-            Register ** tr = table.exposeTable()+j;
-            const uint16_t registerVal = table.getRegisterVal((**tr).address);
+            Register * tr = table.exposeTable()+j;
+            const uint16_t registerVal = table.getRegisterVal(tr->address);
 
             Serial.print("Index ");
             Serial.print(j, DEC);
             Serial.print(" gives 0x");
             Serial.print((unsigned long)tr, HEX);
-            Serial.print(" points to 0x");
-            Serial.print((unsigned long)*tr, HEX);
-            Serial.print(" points to Register Address ");
-            Serial.print((*tr)->address, DEC);
+            Serial.print(" holds Register Address ");
+            Serial.print(tr->address, DEC);
             Serial.print(" with value ");
-            Serial.print((*tr)->value, DEC);
+            Serial.print(tr->value, DEC);
             Serial.print(":");
             Serial.println(registerVal, DEC);
         }
@@ -247,26 +709,26 @@ const void test() {
         Serial.println("");
     }
 
-    // End result should look like this:
-    //  Index 0 gives 0x205 points to 0x1FF points to Register Address 1 with value 55:55
-    //  Index 1 gives 0x207 points to 0x1F3 points to Register Address 2 with value 44:44
-    //  Index 2 gives 0x209 points to 0x1E7 points to Register Address 3 with value 33:33
-    //  Index 3 gives 0x20B points to 0x1ED points to Register Address 4 with value 22:22
-    //  Index 4 gives 0x20D points to 0x1E1 points to Register Address 5 with value 11:11
+    // End result should look like this (storage never moves, registers slide down in place, 4 bytes apart):
+    //  Index 0 gives 0x1E1 holds Register Address 1 with value 55:55
+    //  Index 1 gives 0x1E5 holds Register Address 2 with value 44:44
+    //  Index 2 gives 0x1E9 holds Register Address 3 with value 33:33
+    //  Index 3 gives 0x1ED holds Register Address 4 with value 22:22
+    //  Index 4 gives 0x1F1 holds Register Address 5 with value 11:11
     //
-    //  Index 0 gives 0x211 points to 0x1F3 points to Register Address 2 with value 44:44
-    //  Index 1 gives 0x213 points to 0x1E7 points to Register Address 3 with value 33:33
-    //  Index 2 gives 0x215 points to 0x1ED points to Register Address 4 with value 22:22
-    //  Index 3 gives 0x217 points to 0x1E1 points to Register Address 5 with value 11:11
+    //  Index 0 gives 0x1E1 holds Register Address 2 with value 44:44
+    //  Index 1 gives 0x1E5 holds Register Address 3 with value 33:33
+    //  Index 2 gives 0x1E9 holds Register Address 4 with value 22:22
+    //  Index 3 gives 0x1ED holds Register Address 5 with value 11:11
     //
-    //  Index 0 gives 0x209 points to 0x1E7 points to Register Address 3 with value 33:33
-    //  Index 1 gives 0x20B points to 0x1ED points to Register Address 4 with value 22:22
-    //  Index 2 gives 0x20D points to 0x1E1 points to Register Address 5 with value 11:11
+    //  Index 0 gives 0x1E1 holds Register Address 3 with value 33:33
+    //  Index 1 gives 0x1E5 holds Register Address 4 with value 22:22
+    //  Index 2 gives 0x1E9 holds Register Address 5 with value 11:11
     //
-    //  Index 0 gives 0x203 points to 0x1ED points to Register Address 4 with value 22:22
-    //  Index 1 gives 0x205 points to 0x1E1 points to Register Address 5 with value 11:11
+    //  Index 0 gives 0x1E1 holds Register Address 4 with value 22:22
+    //  Index 1 gives 0x1E5 holds Register Address 5 with value 11:11
     //
-    //  Index 0 gives 0x1DD points to 0x1E1 points to Register Address 5 with value 11:11
+    //  Index 0 gives 0x1E1 holds Register Address 5 with value 11:11
 }
 #endif // RUN_TESTS
 
@@ -0,0 +1,98 @@
+#include <Arduino.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "constants.h"
+#include "registers.h"
+#include "bitbank.h"
+
+#ifndef REGMAP_H
+#define REGMAP_H
+
+// Compile-time register maps
+//
+// A layout that is fixed at build time can be declared as a global instead of being built with
+// addRegister() in setup():
+//
+//     StaticRegisterMap<MB_REGISTER_HOLDING, 0, 16, 0x1234, 100> holdings;  // 40001..40016
+//     StaticBitMap<MB_REGISTER_COIL, 32> coils;                              // 00001..00032
+//     static_assert(StaticMapBytes<decltype(holdings), decltype(coils)>::value <= MB_STATIC_RAM_BUDGET, "");
+//     ...
+//     peripheral.attach(holdings);
+//     peripheral.attach(coils);
+//
+// The values live in .data, so there's no heap use and no sorting at startup, and an address in
+// the map resolves with a subtraction. A map that doesn't fit MB_STATIC_RAM_BUDGET fails the build.
+
+#ifndef MB_STATIC_RAM_BUDGET
+#define MB_STATIC_RAM_BUDGET 1024   // bytes, per map (and for StaticMapBytes checks in the sketch)
+#endif
+
+// 'COUNT' 16-bit registers starting at protocol address 'FIRST', initialised from 'VALUES'
+// (missing trailing values start at 0)
+template <REGISTER_T TYPE, uint16_t FIRST, uint16_t COUNT, uint16_t... VALUES>
+class StaticRegisterMap : public RegisterBlock {
+    static_assert(TYPE == MB_REGISTER_INPUT || TYPE == MB_REGISTER_HOLDING,
+                  "StaticRegisterMap holds 16-bit registers, use StaticBitMap for coils/discretes");
+    static_assert(COUNT > 0 && uint32_t(FIRST) + COUNT <= MB_SPACE_SIZE, "register range falls outside its Modbus space");
+    static_assert(sizeof...(VALUES) <= COUNT, "more initial values than registers");
+    static_assert(COUNT * sizeof(uint16_t) <= MB_STATIC_RAM_BUDGET, "register map exceeds MB_STATIC_RAM_BUDGET");
+
+    public:
+        static constexpr size_t BYTES = COUNT * sizeof(uint16_t);
+        uint16_t storage[COUNT];
+
+        constexpr StaticRegisterMap()
+        : RegisterBlock{FIRST, COUNT, storage, nullptr, 0},
+          storage{VALUES...} {}
+};
+
+// 'COUNT' coils or discretes starting at protocol address 0, initialised from the packed bytes 'PACKED'
+// (LSB first, same as a Read Coils response)
+template <REGISTER_T TYPE, uint16_t COUNT, uint8_t... PACKED>
+class StaticBitMap {
+    static_assert(TYPE == MB_REGISTER_COIL || TYPE == MB_REGISTER_DISCRETE,
+                  "StaticBitMap holds 1-bit registers, use StaticRegisterMap for inputs/holdings");
+    static_assert(COUNT > 0 && COUNT <= MB_SPACE_SIZE, "bit range falls outside its Modbus space");
+    static_assert(sizeof...(PACKED) <= (COUNT + 7u) / 8u, "more initial bytes than the map holds");
+    static_assert((COUNT + 7u) / 8u <= MB_STATIC_RAM_BUDGET, "bit map exceeds MB_STATIC_RAM_BUDGET");
+
+    public:
+        static constexpr size_t BYTES = (COUNT + 7u) / 8u;
+        uint8_t storage[BYTES];
+
+        constexpr StaticBitMap() : storage{PACKED...} {}
+};
+
+// 'COUNT' addresses starting at protocol address 'FIRST' that are read and written through callbacks
+// when a request touches them, instead of being stored (see RegisterBinding):
+//
+//     BoundRange<MB_REGISTER_DISCRETE, 0, 8> buttons(boundDigitalRead, nullptr, 2);     // 10001..10008 = pins 2..9
+//     BoundRange<MB_REGISTER_INPUT, 0, 6> sensors(boundAnalogRead, nullptr, A0);         // 30001..30006 = A0..A5
+//     BoundRange<MB_REGISTER_COIL, 0, 4> relays(boundDigitalRead, boundDigitalWrite, 10); // 00001..00004 = pins 10..13
+//     ...
+//     peripheral.bind(buttons);
+//
+// 'key' is handed to the callbacks for the first address, key + 1 for the next one and so on.
+template <REGISTER_T TYPE, uint16_t FIRST, uint16_t COUNT>
+class BoundRange : public RegisterBinding {
+    static_assert(COUNT > 0 && uint32_t(FIRST) + COUNT <= MB_SPACE_SIZE, "bound range falls outside its Modbus space");
+
+    public:
+        constexpr BoundRange(BindingRead read, BindingWrite write = nullptr, const uint16_t key = 0)
+        : RegisterBinding{FIRST, COUNT, key, read, write, nullptr} {}
+};
+
+// Ready-made callbacks for binding addresses to pins ('key' is the pin)
+static inline uint16_t boundDigitalRead(const uint16_t pin) { return digitalRead(pin); }
+static inline uint16_t boundAnalogRead(const uint16_t pin) { return analogRead(pin); }
+static inline bool boundDigitalWrite(const uint16_t pin, const uint16_t value) { digitalWrite(pin, value ? HIGH : LOW); return true; }
+static inline bool boundAnalogWrite(const uint16_t pin, const uint16_t value) { analogWrite(pin, value); return true; }
+
+// Total RAM of a set of static maps, for checking a whole layout against a budget at compile time
+template <class... MAPS> struct StaticMapBytes;
+template <> struct StaticMapBytes<> { static constexpr size_t value = 0; };
+template <class MAP, class... REST> struct StaticMapBytes<MAP, REST...> {
+    static constexpr size_t value = MAP::BYTES + StaticMapBytes<REST...>::value;
+};
+
+#endif // REGMAP_H
@@ -0,0 +1,139 @@
+#include <Arduino.h>
+#include <Stream.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "crc.h"
+#include "frame.h"
+
+#ifndef MODBUS_RTU_H
+#define MODBUS_RTU_H
+
+// Inter-character timing (Modbus over Serial Line v1.02, 2.5.1.1)
+// A character is 11 bits on the wire (start, 8 data, parity or 2nd stop, stop).
+// A gap of more than 1.5 characters inside a frame is an error, 3.5 characters of silence ends it.
+// Above 19200 baud the spec fixes them at 750us and 1750us instead of scaling further down.
+#define MB_RTU_FIXED_TIMING_BAUD    19200ul
+#define MB_RTU_FIXED_T15_US         750ul
+#define MB_RTU_FIXED_T35_US         1750ul
+#define MB_RTU_MIN_FRAME            4       // address, function, CRC
+
+static inline const unsigned long rtuSilenceMicros(const unsigned long baud, const uint8_t halfChars) {
+    if (baud > MB_RTU_FIXED_TIMING_BAUD || baud == 0)
+        return halfChars <= 3 ? MB_RTU_FIXED_T15_US : MB_RTU_FIXED_T35_US;
+
+    // 11 bits per char, halfChars/2 chars, in microseconds (rounded up)
+    return (11000000ul * halfChars + (2 * baud - 1)) / (2 * baud);
+}
+
+// Incremental RTU frame receiver
+//
+// Bytes go into a fixed buffer as they arrive, either pulled from a Stream by poll() from loop(), or
+// pushed by feed() from a UART receive interrupt. The CRC is folded in per byte, and the frame is
+// complete once the line has been quiet for t3.5. Nothing here blocks: poll() returns false right
+// away until a whole frame is ready.
+class RtuReceiver {
+    protected:
+        uint8_t buffer[MB_ADU_MAX];
+        volatile size_t length = 0;
+        volatile unsigned long lastByteAt = 0;
+        Crc16 crc;
+
+        unsigned long t15 = MB_RTU_FIXED_T15_US;
+        unsigned long t35 = MB_RTU_FIXED_T35_US;
+
+        volatile bool overflow = false;     // frame longer than MB_ADU_MAX
+        volatile bool broken = false;       // t1.5 < gap < t3.5 inside the frame
+        volatile bool complete = false;     // t3.5 silence seen, frame handed out by poll()
+        volatile bool missed = false;       // bytes came in while the last frame was still handed out
+        bool strictTiming = false;
+
+        // Start over for the next frame. With an interrupt feeding bytes in, call with interrupts masked.
+        const void reset() {
+            length = 0;
+            overflow = broken = complete = false;
+            crc.reset();
+        }
+
+        const bool checkSilence(const unsigned long now) {
+            if (length == 0 || now - lastByteAt < t35) return false;
+            complete = true;
+            return true;
+        }
+
+    public:
+        RtuReceiver() {}
+
+        const void setBaud(const unsigned long baud) {
+            t15 = rtuSilenceMicros(baud, 3);
+            t35 = rtuSilenceMicros(baud, 7);
+        }
+
+        // Per-byte timestamps are only trustworthy when fed from the receive interrupt; poll()
+        // timestamps a whole batch at once, so the t1.5 check is off unless this is set.
+        const void setStrictTiming(const bool strict) { strictTiming = strict; }
+
+        // Add one received byte (safe to call from the UART receive ISR)
+        const void feed(const uint8_t b, const unsigned long now) {
+            if (complete) {
+                // The buffer still holds the frame being answered. This byte is lost, so whatever
+                // it starts is unusable; remember that, so the rest of it is rejected as a framing
+                // error instead of being taken for a frame of its own.
+                missed = true;
+                lastByteAt = now;
+                return;
+            }
+
+            if (length == 0) {
+                if (missed && now - lastByteAt < t35) broken = true;
+                missed = false;
+            }
+            else if (strictTiming && now - lastByteAt > t15) broken = true;
+
+            if (length < MB_ADU_MAX) {
+                buffer[length] = b;
+                length = length + 1;
+                crc.update(b);
+            }
+            else overflow = true;
+
+            lastByteAt = now;
+        }
+
+        // Done with the frame poll() handed out: the buffer takes the next one from here on (poll()
+        // also does this, but bytes that arrive before then are lost)
+        const void release() {
+            noInterrupts();
+            if (complete) reset();
+            interrupts();
+        }
+
+        // Interrupt-fed: only check whether the line has gone quiet. Returns true once per frame.
+        const bool poll(const unsigned long now) {
+            noInterrupts();
+            if (complete) reset();  // the frame handed out last time is done with
+            const bool done = checkSilence(now);
+            interrupts();
+            return done;
+        }
+
+        // Stream-fed: drain whatever is buffered, then check for end of frame. Returns true once per frame.
+        const bool poll(Stream& stream, const unsigned long now) {
+            release();
+
+            // Bytes still queued in the stream are part of this frame however long loop() took to get
+            // here, so the silence check only starts once it's drained (and restarts on each byte)
+            int c;
+            while (stream.available() > 0 && (c = stream.read()) >= 0) feed(uint8_t(c), now);
+
+            return checkSilence(now);
+        }
+
+        // Frame handed out by poll(); valid until the next poll()
+        uint8_t * frame() { return buffer; }
+        const size_t frameLength() const { return length; }
+        const bool crcOk() const { return crc.residueOk(); }
+        const bool framingError() const { return overflow || broken || length < MB_RTU_MIN_FRAME; }
+        const bool receiving() const { return length > 0 && !complete; }
+};
+
+#endif // MODBUS_RTU_H
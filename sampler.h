@@ -0,0 +1,195 @@
+#include <Arduino.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef MODBUS_SAMPLER_H
+#define MODBUS_SAMPLER_H
+
+// Background analog sampling
+//
+// An AnalogSampler reads its channels on a fixed schedule from loop() (or a scheduler task), so
+// the samples are evenly spaced no matter how often the bus asks for them, and keeps the latest
+// MB_SAMPLER_DEPTH of each channel in a ring. Each stored sample can be the average of several
+// consecutive readings (decimation), which also lowers the rate samples are stored at.
+//
+// Once attached to a peripheral, channel c is served from the input registers starting at
+// protocol address MB_SAMPLER_BASE + c * MB_SAMPLER_STRIDE (38001.. by default for channel 0):
+//
+//   +0, +1     sequence number of the oldest buffered sample (the first one stored is 0)
+//   +2, +3     when the oldest buffered sample was taken, micros()
+//   +4, +5     microseconds between stored samples
+//   +6         samples buffered
+//   +7         readings skipped because poll() came too late
+//   +8 ...     the buffered samples, oldest first (0 past the last one)
+//
+// Reading these doesn't remove anything; with the sequence number the controller can tell which
+// samples it has already seen. Read FIFO Queue (0x18) with the channel's base address as the FIFO
+// pointer does remove them, up to 31 per request.
+
+#ifndef MB_SAMPLER_CHANNELS
+#ifdef ARDUINO
+#define MB_SAMPLER_CHANNELS     2
+#else
+#define MB_SAMPLER_CHANNELS     4
+#endif
+#endif
+
+#ifndef MB_SAMPLER_DEPTH
+#ifdef ARDUINO
+#define MB_SAMPLER_DEPTH        32
+#else
+#define MB_SAMPLER_DEPTH        117     // a whole channel block fits one 125 register read
+#endif
+#endif
+
+#ifndef MB_SAMPLER_BASE
+#define MB_SAMPLER_BASE         8000    // protocol address of channel 0's block (input space)
+#endif
+
+#define MB_SAMPLER_HEADER       8
+#define MB_SAMPLER_STRIDE       (MB_SAMPLER_HEADER + MB_SAMPLER_DEPTH)
+#define MB_SAMPLER_REGISTERS    (MB_SAMPLER_CHANNELS * MB_SAMPLER_STRIDE)
+#define MB_FIFO_MAX             31      // values per Read FIFO Queue reply (Modbus spec)
+
+#if MB_SAMPLER_BASE + MB_SAMPLER_REGISTERS > 9999
+#error "MB_SAMPLER_BASE leaves no room for the sampler blocks in the input register space"
+#endif
+
+#if MB_SAMPLER_DEPTH > 255
+#error "MB_SAMPLER_DEPTH must be 255 or less"
+#endif
+
+class AnalogSampler {
+    protected:
+        struct Channel {
+            uint8_t     pin = 0;
+            uint8_t     head = 0;       // oldest sample
+            uint8_t     count = 0;
+            uint32_t    sum = 0;        // readings of the sample being averaged
+            uint16_t    samples[MB_SAMPLER_DEPTH];
+        };
+
+        Channel         channels[MB_SAMPLER_CHANNELS];
+        uint8_t         channelCount = 0;
+        uint16_t        decimation = 1;
+        uint16_t        readings = 0;       // taken towards the sample being averaged
+        unsigned long   interval = 0;       // between readings, 0 while stopped
+        unsigned long   nextReading = 0;
+        unsigned long   newestAt = 0;       // when the newest stored sample was completed
+        uint32_t        sequence = 0;       // samples stored so far, on every channel
+        uint16_t        skipped = 0;
+
+        const void store() {
+            for (uint8_t c = 0; c < channelCount; c++) {
+                Channel& ch = channels[c];
+                const uint16_t value = ch.sum / decimation;
+                ch.sum = 0;
+
+                // Full: the oldest sample makes room
+                if (ch.count == MB_SAMPLER_DEPTH) { ch.head = (ch.head + 1) % MB_SAMPLER_DEPTH; ch.count--; }
+                ch.samples[(ch.head + ch.count) % MB_SAMPLER_DEPTH] = value;
+                ch.count++;
+            }
+            sequence++;
+        }
+
+    public:
+        AnalogSampler() {}
+
+        // Sample 'pins' every 'intervalMicros', storing the average of every 'average' readings
+        const bool begin(const uint8_t * pins, const uint8_t count, const unsigned long intervalMicros,
+                         const uint16_t average = 1) {
+            if (count == 0 || count > MB_SAMPLER_CHANNELS || intervalMicros == 0 || average == 0) return false;
+
+            channelCount = count;
+            for (uint8_t c = 0; c < count; c++) {
+                channels[c] = Channel();
+                channels[c].pin = pins[c];
+            }
+            decimation = average;
+            readings = 0;
+            interval = intervalMicros;
+            nextReading = micros();
+            sequence = 0;
+            skipped = 0;
+            return true;
+        }
+
+        const void end() { interval = 0; }
+        const bool running() const { return interval != 0; }
+
+        // Take the reading that's due, if any; call as often as possible. Readings stay on the
+        // original schedule; ones already missed entirely are skipped rather than bunched up.
+        const void poll(const unsigned long now) {
+            if (interval == 0 || long(now - nextReading) < 0) return;
+
+            for (uint8_t c = 0; c < channelCount; c++) channels[c].sum += analogRead(channels[c].pin);
+
+            const unsigned long late = now - nextReading;
+            if (late >= interval) {
+                skipped += late / interval;
+                nextReading += (late / interval) * interval;
+            }
+            const unsigned long takenAt = nextReading;
+            nextReading += interval;
+
+            if (++readings < decimation) return;
+            readings = 0;
+            newestAt = takenAt;
+            store();
+        }
+
+        const uint8_t size() const { return channelCount; }
+        const uint8_t buffered(const uint8_t channel) const { return channels[channel].count; }
+
+        // Remove up to 'max' of the oldest samples of 'channel' into 'out' (big-endian, as on the
+        // wire); returns how many
+        const uint8_t drain(const uint8_t channel, uint8_t * out, const uint8_t max) {
+            Channel& ch = channels[channel];
+            uint8_t n = 0;
+
+            for (; n < max && ch.count > 0; n++) {
+                const uint16_t v = ch.samples[ch.head];
+                out[2 * n] = highByte(v);
+                out[2 * n + 1] = lowByte(v);
+                ch.head = (ch.head + 1) % MB_SAMPLER_DEPTH;
+                ch.count--;
+            }
+
+            return n;
+        }
+
+        // Channel block (see above) a protocol input address falls in, or -1
+        const int channelAt(const uint16_t address) const {
+            if (address < MB_SAMPLER_BASE || address >= MB_SAMPLER_BASE + channelCount * MB_SAMPLER_STRIDE) return -1;
+            return (address - MB_SAMPLER_BASE) / MB_SAMPLER_STRIDE;
+        }
+
+        // Input register at protocol address 'address'; only valid where channelAt() isn't -1
+        const uint16_t word(const uint16_t address) const {
+            const uint8_t c = (address - MB_SAMPLER_BASE) / MB_SAMPLER_STRIDE;
+            const uint16_t offset = (address - MB_SAMPLER_BASE) % MB_SAMPLER_STRIDE;
+            const Channel& ch = channels[c];
+
+            const unsigned long period = interval * decimation;
+            const uint32_t oldestSeq = sequence - ch.count;
+            const unsigned long oldestAt = newestAt - (ch.count > 0 ? (ch.count - 1) * period : 0);
+
+            switch (offset) {
+                case 0:  return uint16_t(oldestSeq >> 16);
+                case 1:  return uint16_t(oldestSeq);
+                case 2:  return uint16_t(oldestAt >> 16);
+                case 3:  return uint16_t(oldestAt);
+                case 4:  return uint16_t(period >> 16);
+                case 5:  return uint16_t(period);
+                case 6:  return ch.count;
+                case 7:  return skipped;
+                default: {
+                    const uint16_t i = offset - MB_SAMPLER_HEADER;
+                    return i < ch.count ? ch.samples[(ch.head + i) % MB_SAMPLER_DEPTH] : 0;
+                }
+            }
+        }
+};
+
+#endif // MODBUS_SAMPLER_H
@@ -0,0 +1,154 @@
+#include <Arduino.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef MODBUS_SCHEDULER_H
+#define MODBUS_SCHEDULER_H
+
+// Cooperative scheduler for loop()
+//
+// Tasks are plain functions registered with a period in microseconds and a priority. Every call to
+// poll() runs each task that is due, at most once, most urgent first: higher priority wins, and
+// between equal priorities the earlier deadline. Nothing is preempted, so a task has to return
+// quickly; that's what makes it safe for tasks to share the register table without locking.
+//
+// A period of 0 makes a background task that runs on every poll() (the bus service task, say).
+// Periodic tasks stay on their original schedule. A task that starts a whole period or more late
+// has overrun: the periods it missed are counted, not run back to back, and the overrun handler
+// (if any) is told.
+//
+//     Scheduler scheduler;
+//     scheduler.add(serviceBus, 0);                // as often as possible
+//     scheduler.add(controlLoop, 1000, 10);        // every 1 ms, ahead of everything else
+//     scheduler.add(scanInputs, 20000);            // every 20 ms
+//     ...
+//     void loop() { scheduler.poll(micros()); }
+
+#ifndef MB_SCHEDULER_TASKS
+#define MB_SCHEDULER_TASKS  8
+#endif
+
+#if MB_SCHEDULER_TASKS > 16
+#error "MB_SCHEDULER_TASKS must be 16 or less"
+#endif
+
+typedef void (*TaskCallback)(void * context);
+typedef void (*OverrunHandler)(const uint8_t task, const unsigned long lateMicros);
+
+// One registered task and how it has been keeping up
+struct Task {
+    TaskCallback    run = nullptr;
+    void *          context = nullptr;
+    unsigned long   period = 0;         // microseconds, 0 for a background task
+    unsigned long   due = 0;            // next deadline, micros()
+    uint8_t         priority = 0;       // higher runs first
+    uint32_t        runs = 0;
+    uint16_t        overruns = 0;       // periods missed altogether
+    unsigned long   worstLate = 0;      // longest start after the deadline (jitter)
+    unsigned long   worstRun = 0;       // longest single run
+};
+
+class Scheduler {
+    protected:
+        Task            tasks[MB_SCHEDULER_TASKS];
+        OverrunHandler  onOverrun = nullptr;
+
+        // Most urgent task that is due at 'now' and hasn't run in this pass, or -1
+        const int next(const unsigned long now, const uint16_t ran) const {
+            int best = -1;
+            for (uint8_t i = 0; i < MB_SCHEDULER_TASKS; i++) {
+                const Task& t = tasks[i];
+                if (t.run == nullptr || (ran & (1u << i)) || long(now - t.due) < 0) continue;
+
+                if (best < 0 || t.priority > tasks[best].priority
+                    || (t.priority == tasks[best].priority && long(t.due - tasks[best].due) < 0))
+                    best = i;
+            }
+            return best;
+        }
+
+    public:
+        Scheduler() {}
+
+        // Run 'run(context)' every 'periodMicros' (0: on every poll()), first at the next poll();
+        // returns the task's id, or -1 if all MB_SCHEDULER_TASKS slots are taken
+        const int add(TaskCallback run, const unsigned long periodMicros, const uint8_t priority = 0,
+                      void * context = nullptr) {
+            if (run == nullptr) return -1;
+
+            for (uint8_t i = 0; i < MB_SCHEDULER_TASKS; i++) {
+                if (tasks[i].run != nullptr) continue;
+
+                tasks[i] = Task();
+                tasks[i].run = run;
+                tasks[i].context = context;
+                tasks[i].period = periodMicros;
+                tasks[i].priority = priority;
+                tasks[i].due = micros();
+                return i;
+            }
+            return -1;
+        }
+
+        const void remove(const uint8_t id) { if (id < MB_SCHEDULER_TASKS) tasks[id] = Task(); }
+
+        // Called from poll() with the task's id and how late it started, whenever a task overruns
+        const void setOverrunHandler(OverrunHandler handler) { onOverrun = handler; }
+
+        // Run every task that is due; call it from loop() as often as possible
+        const void poll(const unsigned long now) {
+            uint16_t ran = 0;
+            unsigned long clock = now;
+
+            for (int i = next(clock, ran); i >= 0; i = next(clock, ran)) {
+                Task& t = tasks[i];
+                ran |= 1u << i;
+
+                const unsigned long late = clock - t.due;
+                if (late > t.worstLate) t.worstLate = late;
+
+                if (t.period == 0) t.due = clock;
+                else {
+                    // Keep the phase: the next deadline is the first one still ahead
+                    const unsigned long missed = late / t.period;
+                    t.due += (missed + 1) * t.period;
+                    if (missed > 0) {
+                        t.overruns += missed;
+                        if (onOverrun != nullptr) onOverrun(i, late);
+                    }
+                }
+
+                const unsigned long start = micros();
+                t.run(t.context);
+                const unsigned long took = micros() - start;
+                if (took > t.worstRun) t.worstRun = took;
+                t.runs++;
+
+                clock += took;  // deadlines are judged against the time the task actually starts
+            }
+        }
+
+        // Microseconds from 'now' until the next periodic task is due (0 if one already is); for
+        // sleeping between polls. ~0ul when there are only background tasks, or none.
+        const unsigned long idleFor(const unsigned long now) const {
+            unsigned long idle = ~0ul;
+            for (uint8_t i = 0; i < MB_SCHEDULER_TASKS; i++) {
+                const Task& t = tasks[i];
+                if (t.run == nullptr || t.period == 0) continue;
+                if (long(t.due - now) <= 0) return 0;
+                if (t.due - now < idle) idle = t.due - now;
+            }
+            return idle;
+        }
+
+        const Task& task(const uint8_t id) const { return tasks[id]; }
+
+        // Overruns across all tasks
+        const uint32_t overruns() const {
+            uint32_t total = 0;
+            for (uint8_t i = 0; i < MB_SCHEDULER_TASKS; i++) total += tasks[i].overruns;
+            return total;
+        }
+};
+
+#endif // MODBUS_SCHEDULER_H
@@ -0,0 +1,166 @@
+#include <Arduino.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#if !defined(__AVR__) && defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#ifndef MODBUS_TELEMETRY_H
+#define MODBUS_TELEMETRY_H
+
+// Hot-path counters, readable by the master as input registers
+//
+// The peripheral counts every frame by its RX_STATE outcome and times every request it executes,
+// per function code. The numbers are served from a reserved block of input registers starting at
+// protocol address MB_TELEMETRY_BASE (so 39001.. by default), laid out as:
+//
+//   +0         layout version (MB_TELEMETRY_VERSION)
+//   +1         number of function code slots (MB_TELEMETRY_SLOTS)
+//   +2         free heap, bytes (0 where it can't be measured)
+//   +3         input and holding registers (both tables)
+//   +4         coils
+//   +5         discretes
+//   +6         exception replies
+//   +7         requests whose function code didn't get a slot
+//   +8         frames received (any outcome)
+//   +9..+15    frames per RX_STATE, STATE_RXERROR (+9) to STATE_NORMAL (+15)
+//   +16 + 6n   slot n: function code, request count (high word, low word), min/max/EWMA micros
+//
+// 16-bit counters wrap, so a master should work with differences between two reads.
+
+#ifndef MB_TELEMETRY_BASE
+#define MB_TELEMETRY_BASE       9000    // protocol address of the first register (input space)
+#endif
+
+#ifndef MB_TELEMETRY_SLOTS
+#define MB_TELEMETRY_SLOTS      16      // function codes timed separately, handed out on first use
+#endif
+
+#define MB_TELEMETRY_VERSION    1
+#define MB_TELEMETRY_EWMA_SHIFT 3       // EWMA weight of a new sample is 1/8
+#define MB_TELEMETRY_RX_STATES  8
+#define MB_TELEMETRY_HEADER     (8 + MB_TELEMETRY_RX_STATES)
+#define MB_TELEMETRY_SLOT_WORDS 6
+#define MB_TELEMETRY_REGISTERS  (MB_TELEMETRY_HEADER + MB_TELEMETRY_SLOTS * MB_TELEMETRY_SLOT_WORDS)
+
+#if MB_TELEMETRY_BASE + MB_TELEMETRY_REGISTERS > 9999
+#error "MB_TELEMETRY_BASE leaves no room for the telemetry block in the input register space"
+#endif
+
+#ifdef __AVR__
+extern char * __brkval;
+extern char * __malloc_heap_start;
+#endif
+
+// Bytes between the top of the heap and the stack (AVR), or free in the allocator's arena (glibc)
+static inline const uint16_t freeHeapBytes() {
+#if defined(__AVR__)
+    char top;
+    return uint16_t(&top - (__brkval != nullptr ? __brkval : __malloc_heap_start));
+#elif defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    const size_t free = mallinfo2().fordblks;
+    return free > 0xFFFF ? 0xFFFF : uint16_t(free);
+#else
+    return 0;
+#endif
+}
+
+struct FunctionStats {
+    uint8_t     code = 0;           // 0 while the slot is unused
+    uint32_t    count = 0;
+    uint16_t    minMicros = 0;
+    uint16_t    maxMicros = 0;
+    uint16_t    ewmaMicros = 0;
+
+    const void record(const uint16_t us) {
+        if (count == 0 || us < minMicros) minMicros = us;
+        if (us > maxMicros) maxMicros = us;
+
+        if (count == 0) ewmaMicros = us;
+        else ewmaMicros = ewmaMicros + ((int32_t(us) - int32_t(ewmaMicros)) >> MB_TELEMETRY_EWMA_SHIFT);
+
+        count++;
+    }
+};
+
+class Telemetry {
+    protected:
+        FunctionStats   functions[MB_TELEMETRY_SLOTS];
+        uint16_t        rxStates[MB_TELEMETRY_RX_STATES] = {};
+        uint16_t        exceptions = 0;
+        uint16_t        untracked = 0;
+
+        FunctionStats * slotFor(const uint8_t code) {
+            for (uint8_t i = 0; i < MB_TELEMETRY_SLOTS; i++) {
+                if (functions[i].code == code) return &functions[i];
+                if (functions[i].code == 0) { functions[i].code = code; return &functions[i]; }
+            }
+            return nullptr;
+        }
+
+    public:
+        Telemetry() {}
+
+        // One received frame and what rxADU() made of it (STATE_IDLE isn't a frame)
+        const void countFrame(const uint8_t state) {
+            rxStates[0]++;
+            if (state < MB_TELEMETRY_RX_STATES) rxStates[state]++;
+        }
+
+        // One executed request: its function code (without the exception bit), how long it took and
+        // whether the reply was an exception
+        const void countRequest(const uint8_t code, const unsigned long us, const bool exception) {
+            if (exception) exceptions++;
+
+            FunctionStats * slot = slotFor(code & 0x7F);
+            if (slot == nullptr) { untracked++; return; }
+            slot->record(us > 0xFFFF ? 0xFFFF : uint16_t(us));
+        }
+
+        const void reset() { *this = Telemetry(); }
+
+        const bool contains(const uint16_t address) const {
+            return address >= MB_TELEMETRY_BASE && address < MB_TELEMETRY_BASE + MB_TELEMETRY_REGISTERS;
+        }
+
+        const FunctionStats * stats(const uint8_t code) const {
+            for (uint8_t i = 0; i < MB_TELEMETRY_SLOTS; i++)
+                if (functions[i].code == code) return &functions[i];
+            return nullptr;
+        }
+
+        const uint16_t frames(const uint8_t state) const { return rxStates[state]; }
+
+        // Register 'offset' of the block; the table/coil/discrete sizes (+3..+5) come from the
+        // peripheral and read as 0 here
+        const uint16_t word(const uint16_t offset) const {
+            if (offset >= MB_TELEMETRY_HEADER) {
+                const uint16_t n = (offset - MB_TELEMETRY_HEADER) / MB_TELEMETRY_SLOT_WORDS;
+                if (n >= MB_TELEMETRY_SLOTS) return 0;
+
+                const FunctionStats& f = functions[n];
+                switch ((offset - MB_TELEMETRY_HEADER) % MB_TELEMETRY_SLOT_WORDS) {
+                    case 0:  return f.code;
+                    case 1:  return uint16_t(f.count >> 16);
+                    case 2:  return uint16_t(f.count);
+                    case 3:  return f.minMicros;
+                    case 4:  return f.maxMicros;
+                    default: return f.ewmaMicros;
+                }
+            }
+
+            if (offset >= 8) return rxStates[offset - 8];
+
+            switch (offset) {
+                case 0:  return MB_TELEMETRY_VERSION;
+                case 1:  return MB_TELEMETRY_SLOTS;
+                case 2:  return freeHeapBytes();
+                case 6:  return exceptions;
+                case 7:  return untracked;
+                default: return 0;
+            }
+        }
+};
+
+#endif // MODBUS_TELEMETRY_H
@@ -0,0 +1,36 @@
+/*
+    check.h - Minimal assertions for the host tests (test/)
+
+    Each test is a plain program: CHECK() reports a failed condition with its location and keeps
+    going, and main() returns checkResult() so ctest sees the failure.
+*/
+
+#ifndef MODBUS_TEST_CHECK_H
+#define MODBUS_TEST_CHECK_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+static unsigned long checkFailures = 0;
+static unsigned long checkCount = 0;
+
+#define CHECK(cond) do {                                                            \
+        checkCount++;                                                               \
+        if (!(cond)) { checkFailures++; printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); } \
+    } while (0)
+
+// Deterministic pseudo-random numbers (xorshift32), so a failure reproduces run to run
+static uint32_t checkSeed = 0x2545F491u;
+static inline uint32_t checkRandom() {
+    checkSeed ^= checkSeed << 13;
+    checkSeed ^= checkSeed >> 17;
+    checkSeed ^= checkSeed << 5;
+    return checkSeed;
+}
+
+static inline int checkResult(const char * name) {
+    printf("%s: %lu checks, %lu failed\n", name, checkCount, checkFailures);
+    return checkFailures == 0 ? 0 : 1;
+}
+
+#endif // MODBUS_TEST_CHECK_H
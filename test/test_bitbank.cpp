@@ -0,0 +1,79 @@
+/*
+    test_bitbank.cpp - BitBank's shifted byte copies against a bool-per-coil model
+
+    Random writeBits()/readBits()/set() at every alignment, each checked against a plain array
+    of bools, which is what the packed copies must be indistinguishable from.
+*/
+
+#include <Arduino.h>
+#include <string.h>
+#include "../bitbank.h"
+#include "check.h"
+
+#define MODEL_BITS  2048
+
+static bool model[MODEL_BITS];
+
+// Pack 'count' model bits from 'address' the way a Modbus PDU carries them
+static void packModel(const uint16_t address, const uint16_t count, uint8_t * out) {
+    memset(out, 0, (count + 7) / 8);
+    for (uint16_t i = 0; i < count; i++)
+        if (model[address + i]) out[i >> 3] |= 1u << (i & 7);
+}
+
+int main() {
+    BitBank bank;
+    CHECK(bank.reserve(MODEL_BITS));
+    for (uint16_t i = 0; i < MODEL_BITS; i++) CHECK(bank.set(i, false));     // sizes the bank to the model
+
+    for (int op = 0; op < 3000; op++) {
+        const uint16_t address = checkRandom() % MODEL_BITS;
+        const uint16_t limit = MODEL_BITS - address < MB_MAX_WRITE_BITS ? MODEL_BITS - address : MB_MAX_WRITE_BITS;
+        const uint16_t count = 1 + checkRandom() % limit;
+
+        uint8_t in[(MB_MAX_WRITE_BITS + 7) / 8];
+        uint8_t out[(MB_MAX_READ_BITS + 7) / 8 + 1];
+        uint8_t expected[(MB_MAX_READ_BITS + 7) / 8];
+
+        switch (checkRandom() % 3) {
+            case 0:
+                // Junk past 'count' in the last byte must not be applied
+                for (uint16_t i = 0; i < (count + 7) / 8; i++) in[i] = uint8_t(checkRandom());
+                CHECK(bank.writeBits(address, count, in));
+                for (uint16_t i = 0; i < count; i++) model[address + i] = bitRead(in[i >> 3], i & 7);
+                break;
+
+            case 1: {
+                const bool value = checkRandom() & 1;
+                CHECK(bank.set(address, value));
+                model[address] = value;
+                break;
+            }
+
+            default:
+                // The last byte is padded with 0s, and nothing is written past it
+                out[(count + 7) / 8] = 0x5A;
+                bank.readBits(address, count, out);
+                packModel(address, count, expected);
+                CHECK(memcmp(out, expected, (count + 7) / 8) == 0);
+                CHECK(out[(count + 7) / 8] == 0x5A);
+                break;
+        }
+    }
+
+    // Every bit, one at a time and as one whole read
+    for (uint16_t i = 0; i < MODEL_BITS; i++) CHECK(bank.get(i) == model[i]);
+
+    uint8_t all[MODEL_BITS / 8];
+    uint8_t expected[MODEL_BITS / 8];
+    bank.readBits(0, MODEL_BITS, all);
+    packModel(0, MODEL_BITS, expected);
+    CHECK(memcmp(all, expected, sizeof(all)) == 0);
+
+    // Past the end reads as 0
+    uint8_t beyond[2] = {0xFF, 0xFF};
+    bank.readBits(MODEL_BITS + 100, 16, beyond);
+    CHECK(beyond[0] == 0 && beyond[1] == 0);
+
+    return checkResult("bitbank");
+}
@@ -0,0 +1,106 @@
+/*
+    test_cache.cpp - Cached read replies are dropped by every write that changes what they cover
+
+    Requests go in over a MockUart like the controller's, so a repeated read poll that is answered
+    out of the cache counts a hit. Each kind of write (Write Single Coil, Write Single Register,
+    Mask Write Register and a direct setRegister()) must make the next poll of the range a miss that
+    reads the new values; a write elsewhere must not.
+*/
+
+#include <Arduino.h>
+#include "../ModbusSerial.h"
+#include "../host/MockUart.h"
+#include "check.h"
+
+#define UNIT    0x11
+#define BAUD    115200ul
+#define T35     (MB_RTU_FIXED_T35_US + 1)
+
+static MockUart uart;
+static SerialModmata sm(uart, BAUD, SERIAL_8N1);
+
+// Send the request 'pdu' to UNIT and leave the reply in uart.wire; false if nothing came back
+static bool request(const uint8_t * pdu, const size_t len) {
+    uint8_t frame[MB_ADU_MAX];
+    frame[0] = UNIT;
+    memcpy(frame + 1, pdu, len);
+    const uint16_t crc = crc16(frame, len + 1);
+    frame[len + 1] = lowByte(crc);
+    frame[len + 2] = highByte(crc);
+
+    uart.clearWire();
+    uart.inject(frame, len + 3);
+    hostAdvanceMicros(T35);
+    if (sm.task() != STATE_NORMAL) return false;
+    uart.drain();
+    return uart.wireLen > 0 && crc16(uart.wire, uart.wireLen) == 0;
+}
+
+// Read Holdings 0..3; true if it came out of the cache
+static bool pollHoldings() {
+    const uint8_t pdu[] = {MB_FC_READ_HOLDINGS, 0, 0, 0, 4};
+    const uint32_t hits = sm.cache.hits;
+    CHECK(request(pdu, sizeof(pdu)));
+    return sm.cache.hits == hits + 1;
+}
+
+// Holding 'address' (0..3) as the last poll's reply had it
+static uint16_t polled(const uint8_t address) {
+    return makeWord(uart.wire[3 + 2 * address], uart.wire[4 + 2 * address]);
+}
+
+int main() {
+    sm.setID(UNIT);
+    for (uint16_t i = 0; i < 4; i++) sm.holdings.addRegister(i, 0x100 + i);
+    sm.holdings.addRegister(50, 0);
+    for (uint16_t i = 0; i < 16; i++) CHECK(sm.coils.set(i, false));
+    sm.useTransport(uart);
+
+    // The second of two identical polls is answered from the cache, byte for byte the same
+    CHECK(!pollHoldings());
+    uint8_t first[16];
+    memcpy(first, uart.wire, uart.wireLen);
+    CHECK(pollHoldings());
+    CHECK(memcmp(first, uart.wire, uart.wireLen) == 0);
+
+    // Write Single Register (0x06)
+    const uint8_t write[] = {MB_FC_WRITE_HOLDING, 0, 1, 0x12, 0x34};
+    CHECK(request(write, sizeof(write)));
+    CHECK(!pollHoldings());
+    CHECK(polled(1) == 0x1234);
+    CHECK(pollHoldings());
+
+    // Mask Write Register (0x16): (current AND and-mask) OR (or-mask AND NOT and-mask)
+    const uint8_t mask[] = {MB_FC_MASK_WRITE_HOLDING, 0, 2, 0x00, 0x0F, 0xAB, 0x00};
+    CHECK(request(mask, sizeof(mask)));
+    CHECK(!pollHoldings());
+    CHECK(polled(2) == ((0x102 & 0x000F) | (0xAB00 & ~0x000F)));
+    CHECK(pollHoldings());
+
+    // A direct setRegister() from the sketch
+    sm.holdings.setRegister(3, 0xBEEF);
+    CHECK(!pollHoldings());
+    CHECK(polled(3) == 0xBEEF);
+
+    // ... but not one that stores the value already there, nor a write outside the range
+    sm.holdings.setRegister(3, 0xBEEF);
+    CHECK(pollHoldings());
+    const uint8_t elsewhere[] = {MB_FC_WRITE_HOLDING, 0, 50, 0, 7};
+    CHECK(request(elsewhere, sizeof(elsewhere)));
+    CHECK(pollHoldings());
+    CHECK(polled(0) == 0x100 && polled(1) == 0x1234 && polled(3) == 0xBEEF);
+
+    // Write Single Coil (0x05) drops a cached Read Coils
+    const uint8_t readCoils[] = {MB_FC_READ_COILS, 0, 0, 0, 16};
+    const uint32_t misses = sm.cache.misses;
+    CHECK(request(readCoils, sizeof(readCoils)));
+    CHECK(request(readCoils, sizeof(readCoils)));
+    CHECK(sm.cache.misses == misses + 1);
+    const uint8_t coil[] = {MB_FC_WRITE_COIL, 0, 3, 0xFF, 0x00};
+    CHECK(request(coil, sizeof(coil)));
+    CHECK(request(readCoils, sizeof(readCoils)));
+    CHECK(sm.cache.misses == misses + 2);
+    CHECK(uart.wire[2] == 2 && uart.wire[3] == 0x08 && uart.wire[4] == 0x00);
+
+    return checkResult("cache");
+}
@@ -0,0 +1,144 @@
+/*
+    test_changes.cpp - Read Changes (0x6D) against a model of what changed since the last poll
+
+    Random writes (some storing the value already there), new and deleted registers and writes into
+    an attached block, polled now and then with the change number from the previous reply. Some
+    replies are "lost", so the next poll repeats the old number. Every poll must list exactly the
+    registers the model says changed after it, with their current values.
+*/
+
+#include <Arduino.h>
+#include "../Modbus.h"
+#include "check.h"
+
+#define MODEL_REGS  200
+#define BLOCK_FIRST 300
+#define BLOCK_COUNT 8
+
+static ModmataPeripheral peripheral;
+static uint16_t blockValues[BLOCK_COUNT];
+static RegisterBlock block = {BLOCK_FIRST, BLOCK_COUNT, blockValues, nullptr, 0};
+
+static bool exists[MODEL_REGS];
+static bool dirty[BLOCK_FIRST + BLOCK_COUNT];   // changed after the number the controller passes
+static uint32_t since = 0;
+
+// Every page of one Read Changes scan; 'reported' gets a mark per address, 'seq' the first page's number.
+// False if a page was an exception or listed something out of order or with the wrong value.
+static bool scan(bool * reported, uint32_t& seq) {
+    memset(reported, 0, sizeof(bool) * (BLOCK_FIRST + BLOCK_COUNT));
+    uint16_t start = 0;
+    bool ok = true;
+
+    for (int page = 0; ; page++) {
+        const Result r = peripheral.ReadChanges(MB_REGISTER_HOLDING, since, start);
+        if (r.isException()) return false;
+
+        const uint32_t pageSeq = uint32_t(makeWord(r.DATA[1], r.DATA[2])) << 16 | makeWord(r.DATA[3], r.DATA[4]);
+        if (page == 0) seq = pageSeq;
+
+        const uint16_t resume = makeWord(r.DATA[5], r.DATA[6]);
+        const uint8_t n = r.DATA[7];
+        int32_t previous = int32_t(start) - 1;
+        for (uint8_t i = 0; i < n; i++) {
+            const uint16_t address = makeWord(r.DATA[8 + i*4], r.DATA[9 + i*4]);
+            const uint16_t value = makeWord(r.DATA[10 + i*4], r.DATA[11 + i*4]);
+            ok = ok && int32_t(address) > previous && address < BLOCK_FIRST + BLOCK_COUNT;
+            ok = ok && value == peripheral.holdings.getRegisterVal(address);
+            if (address < BLOCK_FIRST + BLOCK_COUNT) reported[address] = true;
+            previous = address;
+        }
+
+        if (resume == 0xFFFF) return ok;
+        start = resume;
+    }
+}
+
+// Poll like a controller; unless the reply is 'lost', take its number and forget what it listed
+static void poll(const bool lost) {
+    bool reported[BLOCK_FIRST + BLOCK_COUNT];
+    uint32_t seq = 0;
+    CHECK(scan(reported, seq));
+    CHECK(seq == peripheral.holdings.changes());
+
+    bool exact = true;
+    for (uint16_t a = 0; a < BLOCK_FIRST + BLOCK_COUNT; a++) {
+        const bool stored = a >= BLOCK_FIRST || (a < MODEL_REGS && exists[a]);
+        if (reported[a] != (dirty[a] && stored)) exact = false;
+    }
+    CHECK(exact);
+
+    if (lost) return;
+    since = seq;
+    memset(dirty, 0, sizeof(dirty));
+}
+
+int main() {
+    peripheral.holdings.attach(block);
+    for (uint16_t a = 0; a < MODEL_REGS; a += 4) { peripheral.holdings.addRegister(a, a); exists[a] = true; }
+
+    // The first poll lists everything (more than a page)
+    bool reported[BLOCK_FIRST + BLOCK_COUNT];
+    uint32_t seq = 0;
+    CHECK(scan(reported, seq));
+    for (uint16_t a = 0; a < MODEL_REGS; a++) CHECK(reported[a] == exists[a]);
+    for (uint16_t a = BLOCK_FIRST; a < BLOCK_FIRST + BLOCK_COUNT; a++) CHECK(reported[a]);
+    since = seq;
+
+    // A poll right after it that lists nothing, taking the first page's number
+    poll(false);
+
+    // Storing the value already there isn't a change; a delete is, but has nothing to list
+    peripheral.holdings.setRegister(8, 8);
+    poll(false);
+    const uint32_t before = peripheral.holdings.changes();
+    peripheral.holdings.delRegister(8);
+    exists[8] = false;
+    CHECK(peripheral.holdings.changes() == before + 1);
+    poll(false);
+
+    for (int round = 0; round < 2000; round++) {
+        const int ops = checkRandom() % 12;
+        for (int op = 0; op < ops; op++) {
+            const uint16_t a = checkRandom() % MODEL_REGS;
+            const uint16_t value = checkRandom() % 4;           // often the same value again
+            switch (checkRandom() % 6) {
+                case 0: case 1:
+                    if (peripheral.holdings.getRegisterVal(a) != value || !exists[a]) dirty[a] = true;
+                    CHECK(!peripheral.WriteHolding(a, value).isException());
+                    exists[a] = true;
+                    break;
+
+                case 2:
+                    if (peripheral.holdings.getRegisterVal(a) != value || !exists[a]) dirty[a] = true;
+                    peripheral.holdings.setRegister(a, value);
+                    exists[a] = true;
+                    break;
+
+                case 3:
+                    peripheral.holdings.delRegister(a);
+                    exists[a] = false;
+                    dirty[a] = false;       // gone: nothing to list
+                    break;
+
+                case 4: {
+                    // A block is marked as a whole
+                    const uint16_t b = BLOCK_FIRST + value % BLOCK_COUNT;
+                    if (peripheral.holdings.getRegisterVal(b) != value)
+                        for (uint16_t i = 0; i < BLOCK_COUNT; i++) dirty[BLOCK_FIRST + i] = true;
+                    CHECK(!peripheral.WriteHolding(b, value).isException());
+                    break;
+                }
+
+                case 5:
+                    peripheral.holdings.touch(a);
+                    if (exists[a]) dirty[a] = true;
+                    break;
+            }
+        }
+
+        poll(checkRandom() % 4 == 0);
+    }
+
+    return checkResult("changes");
+}
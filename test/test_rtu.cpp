@@ -0,0 +1,103 @@
+/*
+    test_rtu.cpp - RTU frames received through a UartTransport's receive interrupt
+
+    MockUart plays the ISRs, SerialModmata::useTransport() hands its RtuReceiver to them, and the
+    line timing is replayed with hostAdvanceMicros().
+*/
+
+#include <Arduino.h>
+#include "../ModbusSerial.h"
+#include "../host/MockUart.h"
+#include "check.h"
+
+#define UNIT    0x11
+#define BAUD    115200ul
+#define T35     (MB_RTU_FIXED_T35_US + 1)
+
+static MockUart uart;
+static SerialModmata sm(uart, BAUD, SERIAL_8N1);
+
+// Read Holdings of 'count' registers from 0, framed for UNIT
+static size_t readRequest(uint8_t * frame, const uint8_t count) {
+    const uint8_t pdu[] = {UNIT, MB_FC_READ_HOLDINGS, 0, 0, 0, count};
+    memcpy(frame, pdu, sizeof(pdu));
+    const uint16_t crc = crc16(frame, sizeof(pdu));
+    frame[6] = lowByte(crc);
+    frame[7] = highByte(crc);
+    return 8;
+}
+
+// Run the peripheral's bus task until the line has been quiet for t3.5
+static RX_STATE receive() {
+    const RX_STATE early = sm.task();
+    if (early != STATE_IDLE) return early;
+    hostAdvanceMicros(T35);
+    return sm.task();
+}
+
+int main() {
+    sm.setID(UNIT);
+    for (uint16_t i = 0; i < 8; i++) sm.holdings.addRegister(i, 0x100 + i);
+    sm.useTransport(uart);
+
+    uint8_t frame[8];
+    const size_t len = readRequest(frame, 2);
+
+    // A whole frame, answered once the line goes quiet (and not before)
+    uart.inject(frame, len);
+    CHECK(sm.task() == STATE_IDLE);
+    CHECK(uart.available() == 0);           // went to the receiver, not the RX ring
+    hostAdvanceMicros(T35);
+    CHECK(sm.task() == STATE_NORMAL);
+    uart.drain();
+    CHECK(uart.wireLen == 9);
+    CHECK(uart.wire[0] == UNIT && uart.wire[1] == MB_FC_READ_HOLDINGS && uart.wire[2] == 4);
+    CHECK(uart.wire[3] == 0x01 && uart.wire[4] == 0x00 && uart.wire[5] == 0x01 && uart.wire[6] == 0x01);
+    CHECK(crc16(uart.wire, uart.wireLen) == 0);
+    uart.clearWire();
+
+    // A gap over t1.5 inside a frame breaks it (per-byte timestamps from the ISR)
+    uart.inject(frame, 3);
+    hostAdvanceMicros(MB_RTU_FIXED_T15_US + 100);
+    uart.inject(frame + 3, len - 3);
+    CHECK(receive() == STATE_RXERROR);
+    CHECK(uart.drain() == 0);
+
+    // Bytes arriving while the last frame is still handed out are lost; the rest of what they
+    // started is rejected rather than taken for a frame
+    uart.inject(frame, len);
+    hostAdvanceMicros(T35);
+    CHECK(sm.rxADU() == STATE_NORMAL);
+    uart.inject(frame, 4);                  // the head of the next frame, dropped
+    hostAdvanceMicros(100);
+    CHECK(sm.rxADU() == STATE_IDLE);        // lets go of the old frame
+    uart.inject(frame + 4, len - 4);
+    CHECK(receive() == STATE_RXERROR);
+
+    // ... but a frame after proper silence is fine again
+    uart.inject(frame, len);
+    hostAdvanceMicros(T35);
+    CHECK(sm.rxADU() == STATE_NORMAL);
+    uart.inject(frame, 4);                  // lost, and nothing follows it
+    hostAdvanceMicros(T35);
+    CHECK(sm.rxADU() == STATE_IDLE);
+    uart.inject(frame, len);
+    CHECK(receive() == STATE_NORMAL);
+    uart.drain();
+    CHECK(uart.wireLen == 9 && crc16(uart.wire, uart.wireLen) == 0);
+    uart.clearWire();
+
+    // A function we don't have gets an illegal function exception
+    uint8_t unknown[] = {UNIT, 0x2B, 0x0E, 0x01, 0x00, 0, 0};
+    const uint16_t crc = crc16(unknown, 5);
+    unknown[5] = lowByte(crc);
+    unknown[6] = highByte(crc);
+    uart.inject(unknown, sizeof(unknown));
+    CHECK(receive() == STATE_BADFUNCTION);
+    uart.drain();
+    CHECK(uart.wireLen == 5);
+    CHECK(uart.wire[0] == UNIT && uart.wire[1] == (0x2B | 0x80) && uart.wire[2] == MB_EX_ILLEGAL_FUNCTION);
+    CHECK(crc16(uart.wire, uart.wireLen) == 0);
+
+    return checkResult("rtu");
+}
@@ -0,0 +1,80 @@
+/*
+    test_transport.cpp - RS-485 driver enable around replies sent through UartTransport
+
+    MockUart records the DE level every byte went out with. DE has to be up before the first byte
+    of a reply and stay up until the transmit-complete interrupt after the last one, also when the
+    reply is longer than the TX ring and write() has to wait for room.
+*/
+
+#include <Arduino.h>
+#include "../ModbusSerial.h"
+#include "../host/MockUart.h"
+#include "check.h"
+
+#define UNIT    0x11
+#define T35     (MB_RTU_FIXED_T35_US + 1)
+
+static MockUart uart;
+static SerialModmata sm(uart, 115200ul, SERIAL_8N1);
+
+// Send Read Holdings of 'count' registers from 0 and let the peripheral answer it; the reply is
+// queued in the TX ring (or partly sent already, if it didn't fit)
+static void request(const uint8_t count) {
+    uint8_t frame[8] = {UNIT, MB_FC_READ_HOLDINGS, 0, 0, 0, count};
+    const uint16_t crc = crc16(frame, 6);
+    frame[6] = lowByte(crc);
+    frame[7] = highByte(crc);
+
+    uart.clearWire();
+    uart.inject(frame, sizeof(frame));
+    hostAdvanceMicros(T35);
+    CHECK(sm.task() == STATE_NORMAL);
+}
+
+static bool allDriven() {
+    for (size_t i = 0; i < uart.wireLen; i++) if (!uart.wireDriven[i]) return false;
+    return true;
+}
+
+int main() {
+    sm.setID(UNIT);
+    for (uint16_t i = 0; i < 125; i++) sm.holdings.addRegister(i, i);
+    sm.useTransport(uart);
+
+    CHECK(!uart.driverEnabled);
+
+    // Short reply: DE goes up with the first queued byte, before anything is on the wire
+    request(2);
+    CHECK(uart.driverEnabled && uart.wireLen == 0 && !uart.txIdle());
+
+    // Played one interrupt at a time: DE holds through the data-register-empty interrupts,
+    // including a transmit-complete that fires while more is still queued
+    uint8_t b;
+    size_t sent = 0;
+    while (uart.onTxReady(b)) {
+        sent++;
+        CHECK(uart.driverEnabled);
+        if (sent == 3) { uart.onTxComplete(); CHECK(uart.driverEnabled); }
+    }
+    CHECK(sent == 9);
+    CHECK(uart.driverEnabled);              // the last stop bit is still going out
+    uart.onTxComplete();
+    CHECK(!uart.driverEnabled && uart.txIdle());
+
+    // Long reply (255 bytes through a 64 byte ring): one DE pulse covering every byte
+    request(125);
+    CHECK(uart.driverEnabled);
+    uart.drain();
+    CHECK(uart.wireLen == 5 + 2 * 125);
+    CHECK(allDriven());
+    CHECK(uart.deRises == 1);
+    CHECK(!uart.driverEnabled && uart.txIdle());
+    CHECK(crc16(uart.wire, uart.wireLen) == 0);
+
+    // Back to back replies each get their own pulse
+    request(1);
+    uart.drain();
+    CHECK(uart.wireLen == 7 && allDriven() && uart.deRises == 1 && !uart.driverEnabled);
+
+    return checkResult("transport");
+}
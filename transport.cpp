@@ -0,0 +1,41 @@
+/*
+    transport.cpp - USART0 interrupt glue for AvrUsartTransport
+*/
+
+#include "transport.h"
+
+#if defined(__AVR__) && defined(MB_USART_TRANSPORT)
+
+AvrUsartTransport UsartTransport;
+
+#if defined(USART_RX_vect)
+#define _MB_USART_RX_VECT   USART_RX_vect
+#define _MB_USART_UDRE_VECT USART_UDRE_vect
+#define _MB_USART_TX_VECT   USART_TX_vect
+#else
+#define _MB_USART_RX_VECT   USART0_RX_vect
+#define _MB_USART_UDRE_VECT USART0_UDRE_vect
+#define _MB_USART_TX_VECT   USART0_TX_vect
+#endif
+
+ISR(_MB_USART_RX_VECT) {
+    // Read UDR0 even on a framing/overrun error or the interrupt keeps firing
+    const bool bad = UCSR0A & (_BV(FE0) | _BV(DOR0));
+    const uint8_t b = UDR0;
+    if (!bad) UsartTransport.onRxByte(b);
+}
+
+ISR(_MB_USART_UDRE_VECT) {
+    uint8_t b;
+    if (UsartTransport.onTxReady(b)) {
+        UCSR0A |= _BV(TXC0);    // clear any stale transmit-complete from the previous burst
+        UDR0 = b;
+    }
+    else UCSR0B &= ~_BV(UDRIE0);
+}
+
+ISR(_MB_USART_TX_VECT) {
+    UsartTransport.onTxComplete();
+}
+
+#endif // __AVR__ && MB_USART_TRANSPORT
@@ -0,0 +1,195 @@
+#include <Arduino.h>
+#include <Stream.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "rtu.h"
+
+#ifndef MODBUS_TRANSPORT_H
+#define MODBUS_TRANSPORT_H
+
+// Uncomment to drive USART0 directly from this library's interrupts (AVR only).
+// HardwareSerial's Serial owns the same vectors, so it can't be used alongside this.
+//#define MB_USART_TRANSPORT
+
+#ifndef MB_UART_RX_BUFFER
+#define MB_UART_RX_BUFFER   64      // power of two <= 256
+#endif
+
+#ifndef MB_UART_TX_BUFFER
+#define MB_UART_TX_BUFFER   64      // power of two <= 256
+#endif
+
+// Lock-free single-producer/single-consumer byte queue
+// One side runs in an ISR, the other in loop(); each index is only ever written by its own side
+// and is a single byte, so no interrupt masking is needed. Holds N-1 bytes.
+template <uint16_t N>
+class RingBuffer {
+    static_assert(N >= 2 && N <= 256 && (N & (N - 1)) == 0, "RingBuffer size must be a power of two <= 256");
+
+    protected:
+        uint8_t data[N];
+        uint8_t head = 0;   // next slot to write, producer only
+        uint8_t tail = 0;   // next slot to read, consumer only
+
+        static const uint8_t MASK = N - 1;
+
+    public:
+        RingBuffer() {}
+
+        const bool push(const uint8_t b) {
+            const uint8_t h = __atomic_load_n(&head, __ATOMIC_RELAXED);
+            const uint8_t next = (h + 1) & MASK;
+            if (next == __atomic_load_n(&tail, __ATOMIC_ACQUIRE)) return false;    // full
+
+            data[h] = b;
+            __atomic_store_n(&head, next, __ATOMIC_RELEASE);
+            return true;
+        }
+
+        const bool pop(uint8_t& b) {
+            const uint8_t t = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+            if (t == __atomic_load_n(&head, __ATOMIC_ACQUIRE)) return false;      // empty
+
+            b = data[t];
+            __atomic_store_n(&tail, uint8_t((t + 1) & MASK), __ATOMIC_RELEASE);
+            return true;
+        }
+
+        const int peek() const {
+            const uint8_t t = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+            if (t == __atomic_load_n(&head, __ATOMIC_ACQUIRE)) return -1;
+            return data[t];
+        }
+
+        const uint8_t available() const {
+            return (__atomic_load_n(&head, __ATOMIC_ACQUIRE) - __atomic_load_n(&tail, __ATOMIC_ACQUIRE)) & MASK;
+        }
+
+        const bool empty() const { return available() == 0; }
+};
+
+// Interrupt-driven UART under SerialModmata
+//
+// It's a Stream, so SerialModmata/RtuReceiver use it like any other serial port. Received bytes
+// arrive through onRxByte() from the receive ISR, either into the RX ring or, after attachReceiver(),
+// straight into an RtuReceiver with a per-byte timestamp (which makes its t1.5 check usable).
+// write() queues into the TX ring and the data-register-empty ISR sends it. The RS-485 driver enable
+// pin goes high before the first byte and drops in the transmit-complete ISR right after the last
+// stop bit, so there's no fixed turnaround delay and no blocking wait after a reply.
+//
+// Subclasses supply the hardware: AvrUsartTransport below, MockUart for the host build.
+class UartTransport : public Stream {
+    protected:
+        RingBuffer<MB_UART_RX_BUFFER>   rxBuffer;
+        RingBuffer<MB_UART_TX_BUFFER>   txBuffer;
+        RtuReceiver *                   receiver = nullptr;
+        int16_t                         dePin = -1;
+        volatile bool                   sending = false;
+        volatile uint16_t               rxDropped = 0;
+
+        // Start (or keep) calling onTxReady() until it returns false
+        virtual void enableTxInterrupt() = 0;
+
+        // Called while write() waits for room in the TX ring; the ISR frees it on real hardware
+        virtual void waitForTxSpace() {}
+
+        virtual void writeDriverEnable(const bool on) {
+            if (dePin >= 0) digitalWrite(dePin, on ? HIGH : LOW);
+        }
+
+    public:
+        UartTransport() {}
+
+        // RS-485 DE (and /RE, if tied) pin; -1 for none
+        const void setDriverEnablePin(const int16_t pin) {
+            dePin = pin;
+            if (dePin >= 0) { pinMode(dePin, OUTPUT); writeDriverEnable(false); }
+        }
+
+        // Hand received bytes straight to 'r' from the ISR instead of queueing them (for a
+        // SerialModmata, SerialModmata::useTransport() does this with its own receiver)
+        const void attachReceiver(RtuReceiver& r) {
+            receiver = &r;
+            r.setStrictTiming(true);
+        }
+
+        const uint16_t droppedBytes() const { return rxDropped; }
+        const bool txIdle() const { return !sending; }
+
+        // Stream
+
+        int available() override { return rxBuffer.available(); }
+        int peek() override { return rxBuffer.peek(); }
+
+        int read() override {
+            uint8_t b;
+            return rxBuffer.pop(b) ? b : -1;
+        }
+
+        size_t write(const uint8_t b) override {
+            for (;;) {
+                // Masked so the TX-complete ISR of a previous burst can't drop DE between these two steps
+                noInterrupts();
+                if (!sending) { sending = true; writeDriverEnable(true); }
+                const bool queued = txBuffer.push(b);
+                interrupts();
+
+                if (queued) break;
+                enableTxInterrupt();
+                waitForTxSpace();
+            }
+
+            enableTxInterrupt();
+            return 1;
+        }
+
+        using Print::write;
+
+        // Wait for the last queued byte to leave the shift register (and DE to drop)
+        void flush() override {
+            while (sending) waitForTxSpace();
+        }
+
+        // Called from the UART interrupts
+
+        const void onRxByte(const uint8_t b) {
+            if (receiver != nullptr)        receiver->feed(b, micros());
+            else if (!rxBuffer.push(b))     rxDropped = rxDropped + 1;
+        }
+
+        // Next byte for the data register; false means the ring is empty and the interrupt can be disabled
+        const bool onTxReady(uint8_t& b) { return txBuffer.pop(b); }
+
+        const void onTxComplete() {
+            if (!txBuffer.empty()) return;  // more was queued since, keep driving the line
+            writeDriverEnable(false);
+            sending = false;
+        }
+};
+
+#if defined(__AVR__) && defined(MB_USART_TRANSPORT)
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+// USART0 driven by the ISRs in transport.cpp (8N1; U2X for the lower baud error at 115200+)
+class AvrUsartTransport : public UartTransport {
+    protected:
+        void enableTxInterrupt() override { UCSR0B |= _BV(UDRIE0); }
+
+    public:
+        const void begin(const unsigned long baud) {
+            const uint16_t ubrr = (F_CPU / 4 / baud - 1) / 2;
+            UCSR0A = _BV(U2X0);
+            UBRR0H = highByte(ubrr);
+            UBRR0L = lowByte(ubrr);
+            UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+            UCSR0B = _BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0) | _BV(TXCIE0);
+        }
+};
+
+extern AvrUsartTransport UsartTransport;
+
+#endif // __AVR__ && MB_USART_TRANSPORT
+
+#endif // MODBUS_TRANSPORT_H